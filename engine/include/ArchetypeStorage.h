@@ -0,0 +1,213 @@
+#pragma once
+// ArchetypeStorage.h
+// Chunked archetype storage for plain data components.
+// - a data component is a trivially copyable struct declared with DECLARE_DATA_COMPONENT, it has no vtable,
+//   no reference and no lifecycle callbacks. A non virtual bool OnDataRead(BufferReader&) is used by EntityReader
+// - entities with the same set of data components share an archetype. Their components live in fixed size
+//   chunks, one cache line aligned column per component type, so a walk over several components is a linear
+//   pass over each column with no lookups
+// - a column holds one component type, split a hot struct into several data components to walk its fields apart
+// - adding or removing a data component moves the entity's row to the matching archetype, removing one swaps
+//   the archetype's last row into the hole. Both invalidate the pointers handed out for the rows involved
+// - EntitySystem routes AddComponent<T>, GetEntityComponent<T>, DoForEachComponent<T> and friends here when T
+//   is a data component, so components can migrate without changing their call sites
+// - lookups and walks take the storage lock shared, adding and removing take it exclusive. A walk holds it
+//   until it ends, a parallel walk's join only runs the walk's own chunks so no unrelated task runs under it
+// - lookups from inside a walk's func use the walk's lock instead of locking again. Adding or removing data
+//   components from inside a walk is refused with an error, post the change to the main thread instead
+
+#include "CRC64.h"
+#include "BufferReader.h"
+#include "TaskManager.h"
+
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <span>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#define DECLARE_DATA_COMPONENT(CompoentName) \
+static constexpr bool IsDataComponent = true; \
+static size_t GetComponentId() { return Hashes::CRC64Str(#CompoentName); } \
+static const char* GetComponentName() { return #CompoentName; }
+
+namespace ArchetypeStorage
+{
+    static constexpr size_t ChunkBytes = 16 * 1024;
+    static constexpr size_t ColumnAlignment = 64;
+
+    template<class T>
+    concept DataComponent = requires { requires T::IsDataComponent; } && std::is_trivially_copyable_v<T>;
+
+    struct DataComponentInfo
+    {
+        size_t ComponentType = 0;
+        const char* Name = nullptr;
+        size_t Size = 0;
+
+        void (*Construct)(void* component) = nullptr;
+        bool (*Read)(void* component, BufferReader& buffer) = nullptr;
+    };
+
+    struct alignas(ColumnAlignment) ArchetypeChunk
+    {
+        std::byte Memory[ChunkBytes];
+    };
+
+    struct Archetype
+    {
+        // sorted, the column order
+        std::vector<size_t> ComponentTypes;
+        std::vector<const DataComponentInfo*> Components;
+
+        // the entity id column sits at the start of the chunk
+        std::vector<size_t> ColumnOffsets;
+        size_t ChunkCapacity = 0;
+
+        // rows are packed, every chunk is full except the last one in use
+        size_t EntityCount = 0;
+        std::vector<std::unique_ptr<ArchetypeChunk>> Chunks;
+
+        // archetypes one component type away, filled in as entities move
+        std::unordered_map<size_t, Archetype*> AddEdges;
+        std::unordered_map<size_t, Archetype*> RemoveEdges;
+
+        int FindColumn(size_t componentType) const
+        {
+            for (size_t i = 0; i < ComponentTypes.size(); i++)
+            {
+                if (ComponentTypes[i] == componentType)
+                    return int(i);
+            }
+            return -1;
+        }
+
+        size_t* GetEntities(ArchetypeChunk& chunk) const
+        {
+            return std::launder(reinterpret_cast<size_t*>(chunk.Memory));
+        }
+
+        std::byte* GetColumn(ArchetypeChunk& chunk, size_t column) const
+        {
+            return chunk.Memory + ColumnOffsets[column];
+        }
+
+        template<class T>
+        T* GetColumn(ArchetypeChunk& chunk) const
+        {
+            int column = FindColumn(T::GetComponentId());
+            if (column < 0)
+                return nullptr;
+
+            return std::launder(reinterpret_cast<T*>(GetColumn(chunk, size_t(column))));
+        }
+    };
+
+    struct ChunkRef
+    {
+        const Archetype* Type = nullptr;
+        ArchetypeChunk* Chunk = nullptr;
+        size_t Count = 0;
+
+        size_t* GetEntities() const { return Type->GetEntities(*Chunk); }
+
+        template<class T>
+        T* GetColumn() const { return Type->GetColumn<T>(*Chunk); }
+    };
+
+    // marks the calling thread as running a walk's func, the walk's lock covers its lookups
+    void EnterWalk();
+    void LeaveWalk();
+
+    // collects the chunks of every archetype holding all of the component types, holds the storage lock
+    // shared until it goes out of scope
+    struct ChunkWalk
+    {
+        std::shared_lock<std::shared_mutex> Lock;
+        std::vector<ChunkRef> Chunks;
+
+        explicit ChunkWalk(std::span<const size_t> componentTypes);
+
+        // chunks are handed to the worker pool one at a time when paralel is set
+        template<class Func>
+        void Run(Func&& func, bool paralel = false)
+        {
+            auto visit = [&func](const ChunkRef& chunk)
+                {
+                    EnterWalk();
+                    func(chunk);
+                    LeaveWalk();
+                };
+
+            if (paralel)
+            {
+                TaskManager::ParallelFor(0, Chunks.size(), 1, [this, &visit](size_t index) { visit(Chunks[index]); });
+            }
+            else
+            {
+                for (const ChunkRef& chunk : Chunks)
+                    visit(chunk);
+            }
+        }
+    };
+
+    void RegisterComponent(const DataComponentInfo& info);
+
+    template<DataComponent T>
+    void RegisterComponent()
+    {
+        static_assert(alignof(T) <= ColumnAlignment, "data components can not be aligned past a cache line");
+        static_assert(sizeof(T) <= ChunkBytes / 4, "data component is too large for an archetype chunk");
+
+        DataComponentInfo info;
+        info.ComponentType = T::GetComponentId();
+        info.Name = T::GetComponentName();
+        info.Size = sizeof(T);
+        info.Construct = [](void* component) { new (component) T(); };
+
+        if constexpr (requires(T& component, BufferReader& buffer) { { component.OnDataRead(buffer) } -> std::same_as<bool>; })
+            info.Read = [](void* component, BufferReader& buffer) { return static_cast<T*>(component)->OnDataRead(buffer); };
+
+        RegisterComponent(info);
+    }
+
+    bool IsDataComponent(size_t componentType);
+
+    // returns the existing component when the entity already has one, nullptr for unregistered types
+    void* Add(size_t entityId, size_t componentType);
+    void Remove(size_t entityId, size_t componentType);
+    void* Get(size_t entityId, size_t componentType);
+    bool Has(size_t entityId, size_t componentType);
+
+    // components[i] is the component of entities[i] or nullptr, one lock for the whole span
+    void Resolve(size_t componentType, std::span<const size_t> entities, void** components);
+
+    // entities holding all of the component types
+    size_t Count(std::span<const size_t> componentTypes);
+
+    // false when the type has no OnDataRead
+    bool Read(size_t componentType, void* component, BufferReader& buffer);
+
+    void RemoveEntity(size_t entityId);
+    void Clear();
+
+    size_t GetArchetypeCount();
+
+    // func(size_t count, size_t* entities, Ts*... components) once per chunk holding all of Ts,
+    // the columns are indexed the same as the entities
+    template<DataComponent... Ts, class Func> requires (sizeof...(Ts) > 0)
+    void ForEachChunk(Func&& func, bool paralel = false)
+    {
+        const size_t componentTypes[] = { Ts::GetComponentId()... };
+        ChunkWalk walk(componentTypes);
+        walk.Run([&func](const ChunkRef& chunk)
+            {
+                func(chunk.Count, chunk.GetEntities(), chunk.template GetColumn<Ts>()...);
+            }, paralel);
+    }
+}
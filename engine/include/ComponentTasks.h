@@ -1,24 +1,42 @@
 #pragma once
 
 #include "EntitySystem.h"
+#include "EntityQuery.h"
 #include "TaskManager.h"
 #include "FrameStage.h"
 
-template<class T>
-void RegisterComponentWithUpdate(FrameStage state, bool threadUpdate)
+// stepIndependent components read TaskManager::GetFixedStepCount() and can integrate batched fixed steps in one update
+// With components are resolved by a query and passed to T::Update(With&...), entities missing one are skipped,
+// EntitySystem::Optional<C> passes a C* instead
+// returns the update task so it can be ordered with Task::After
+template<class T, class... With>
+LambdaTask* RegisterComponentWithUpdate(FrameStage state, bool threadUpdate, bool stepIndependent = false)
 {
     EntitySystem::RegisterComponent<T>();
 
     auto taskTick = [threadUpdate]()
         {
-            EntitySystem::DoForEachComponent<T>([](T & component)
+            if constexpr (sizeof...(With) == 0)
             {
-                // TODO, check enabled?
+                EntitySystem::DoForEachComponent<T>([](T & component)
+                {
+                    // TODO, check enabled?
 
-                component.Update();
-            },
-            threadUpdate);
+                    component.Update();
+                },
+                threadUpdate);
+            }
+            else
+            {
+                auto update = [](T& component, auto&&... with) { component.Update(with...); };
+                if (threadUpdate)
+                    EntitySystem::Query<T, With...>().ParallelEach(update);
+                else
+                    EntitySystem::Query<T, With...>().Each(update);
+            }
         };
-    TaskManager::AddTaskOnState<LambdaTask>(state, T::GetComponentId(), taskTick);
+    auto task = TaskManager::AddTaskOnState<LambdaTask>(state, T::GetComponentId(), T::GetComponentName(), taskTick);
+    task->StepIndependent = stepIndependent;
+    return task;
 }
 #define SimpleComponentWithUpdate(T)
\ No newline at end of file
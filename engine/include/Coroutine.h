@@ -0,0 +1,141 @@
+#pragma once
+// Coroutine.h
+// C++20 coroutine tasks for work that spans stages or frames without holding a stage barrier.
+// - a function returning Coroutine can co_await:
+//     NextStage(stage)                          resume on the main thread when the stage next starts
+//     Frames(n)                                 resume on the main thread at the start of the frame n frames ahead
+//     ResourceManager::LoadResourceAsync(hash)  resume once the resource is loaded, yields the ResourceInfoRef
+//     another Coroutine                         run it to completion, then continue
+// - TaskManager::StartCoroutine runs one on the calling thread until its first suspension and then owns it,
+//   the frame is freed when it finishes
+// - coroutines are lazy, one that is neither started nor awaited never runs
+// - a coroutine still suspended at shutdown is never resumed
+
+#include "TaskManager.h"
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+class Coroutine
+{
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(Handle handle) noexcept
+        {
+            promise_type& promise = handle.promise();
+            if (promise.Continuation)
+                return promise.Continuation;
+
+            if (promise.Detached)
+                handle.destroy();
+
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type
+    {
+        // the coroutine awaiting this one, resumed when it finishes
+        std::coroutine_handle<> Continuation;
+
+        // started by TaskManager::StartCoroutine, nothing owns the handle
+        bool Detached = false;
+
+        Coroutine get_return_object() { return Coroutine(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Coroutine() = default;
+    explicit Coroutine(Handle handle) : CoroutineHandle(handle) {}
+
+    Coroutine(const Coroutine&) = delete;
+    Coroutine& operator=(const Coroutine&) = delete;
+
+    Coroutine(Coroutine&& other) noexcept : CoroutineHandle(std::exchange(other.CoroutineHandle, nullptr)) {}
+
+    Coroutine& operator=(Coroutine&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (CoroutineHandle)
+                CoroutineHandle.destroy();
+            CoroutineHandle = std::exchange(other.CoroutineHandle, nullptr);
+        }
+        return *this;
+    }
+
+    ~Coroutine()
+    {
+        if (CoroutineHandle)
+            CoroutineHandle.destroy();
+    }
+
+    bool IsDone() const { return !CoroutineHandle || CoroutineHandle.done(); }
+
+    // give up ownership, the caller is responsible for the frame
+    Handle Release() { return std::exchange(CoroutineHandle, nullptr); }
+
+    // co_await on another coroutine starts it and resumes the awaiting one when it finishes
+    bool await_ready() const noexcept { return IsDone(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        CoroutineHandle.promise().Continuation = awaiting;
+        return CoroutineHandle;
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    Handle CoroutineHandle;
+};
+
+// co_await NextStage(stage), resumes on the main thread when the stage next starts, before its tasks
+// are dispatched. Awaiting the stage that is currently running resumes next frame.
+struct NextStage
+{
+    FrameStage Stage;
+
+    explicit NextStage(FrameStage stage) : Stage(stage) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) const { TaskManager::ResumeAtStage(Stage, handle); }
+    void await_resume() const noexcept {}
+};
+
+// co_await Frames(n), resumes on the main thread at the start of the frame n frames from now
+struct Frames
+{
+    uint32_t Count;
+
+    explicit Frames(uint32_t count) : Count(count) {}
+
+    bool await_ready() const noexcept { return Count == 0; }
+    void await_suspend(std::coroutine_handle<> handle) const { TaskManager::ResumeAfterFrames(Count, handle); }
+    void await_resume() const noexcept {}
+};
+
+namespace TaskManager
+{
+    inline void StartCoroutine(Coroutine coroutine)
+    {
+        Coroutine::Handle handle = coroutine.Release();
+        if (!handle)
+            return;
+
+        handle.promise().Detached = true;
+        handle.resume();
+    }
+}
@@ -0,0 +1,317 @@
+#pragma once
+// EntityQuery.h
+// Typed multi-component iteration, EntitySystem::Query<A, B, Optional<C>, Exclude<D>>().Each(func)
+// - func(A&, B&, C*) runs for every enabled entity that has A and B and not D. Arguments follow the term
+//   order, excluded terms are not passed
+// - iteration is driven by the required term with the fewest entities, the other components are resolved a
+//   batch at a time, one lock per table per batch instead of a lookup and a lock per component
+// - when data components drive, the required ones are joined chunk by chunk straight from their columns and
+//   only components that live in tables are looked up
+// - ParallelEach hands batches or chunks to the worker pool, func runs concurrently and must not add or
+//   remove components, the same as a parallel DoForEach. The driver's lock is held until the last batch is
+//   done, the join only runs this query's batches so other pool tasks that add components wait for it
+
+#include "EntitySystem.h"
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace EntitySystem
+{
+    template<class T>
+    struct Optional {};
+
+    template<class T>
+    struct Exclude {};
+
+    namespace QueryTerms
+    {
+        template<class Term>
+        struct Traits
+        {
+            using Component = Term;
+            static constexpr bool Required = true;
+            static constexpr bool Excluded = false;
+        };
+
+        template<class T>
+        struct Traits<Optional<T>>
+        {
+            using Component = T;
+            static constexpr bool Required = false;
+            static constexpr bool Excluded = false;
+        };
+
+        template<class T>
+        struct Traits<Exclude<T>>
+        {
+            using Component = T;
+            static constexpr bool Required = false;
+            static constexpr bool Excluded = true;
+        };
+
+        template<class Term>
+        using ComponentOf = typename Traits<Term>::Component;
+
+        template<class Term>
+        constexpr bool IsData = ArchetypeStorage::DataComponent<ComponentOf<Term>>;
+    }
+
+    template<class... Terms>
+    class Query
+    {
+        static_assert((QueryTerms::Traits<Terms>::Required || ...), "a query needs at least one required term");
+
+    public:
+        static constexpr size_t BatchSize = 128;
+
+        template<class Func>
+        void Each(Func&& func, bool enabledOnly = true)
+        {
+            Run(func, false, enabledOnly);
+        }
+
+        template<class Func>
+        void ParallelEach(Func&& func, bool enabledOnly = true)
+        {
+            Run(func, true, enabledOnly);
+        }
+
+    private:
+        static constexpr size_t TermCount = sizeof...(Terms);
+        using TermIndices = std::index_sequence_for<Terms...>;
+
+        template<size_t I>
+        using TermAt = std::tuple_element_t<I, std::tuple<Terms...>>;
+
+        template<size_t I>
+        using ComponentAt = QueryTerms::ComponentOf<TermAt<I>>;
+
+        // one pointer per entity of the batch and term, nullptr where the entity lacks the component
+        using Batch = std::tuple<std::array<QueryTerms::ComponentOf<Terms>*, BatchSize>...>;
+
+        // null for data terms and tables that were never registered
+        using Tables = std::array<IComponentTable*, TermCount>;
+
+        template<class Term>
+        static IComponentTable* GetTermTable()
+        {
+            if constexpr (QueryTerms::IsData<Term>)
+                return nullptr;
+            else
+                return GetComponentTable(QueryTerms::ComponentOf<Term>::GetComponentId());
+        }
+
+        static std::vector<size_t> GetRequiredDataTypes()
+        {
+            std::vector<size_t> componentTypes;
+            ((QueryTerms::Traits<Terms>::Required && QueryTerms::IsData<Terms> ? componentTypes.push_back(QueryTerms::ComponentOf<Terms>::GetComponentId()) : void()), ...);
+            return componentTypes;
+        }
+
+        template<class Func>
+        void Run(Func& func, bool paralel, bool enabledOnly)
+        {
+            Tables tables = { GetTermTable<Terms>()... };
+
+            size_t driver = TermCount;
+            size_t driverSize = SIZE_MAX;
+            bool missingTable = false;
+            FindTableDriver(tables, driver, driverSize, missingTable, TermIndices{});
+
+            // a required component that was never registered matches nothing
+            if (missingTable)
+                return;
+
+            std::vector<size_t> dataTypes = GetRequiredDataTypes();
+            if (!dataTypes.empty() && ArchetypeStorage::Count(dataTypes) <= driverSize)
+            {
+                DriveFromChunks(func, tables, dataTypes, paralel, enabledOnly);
+                return;
+            }
+
+            DispatchTableDriver(driver, func, tables, paralel, enabledOnly, TermIndices{});
+        }
+
+        template<size_t... I>
+        static void FindTableDriver(const Tables& tables, size_t& driver, size_t& driverSize, bool& missingTable, std::index_sequence<I...>)
+        {
+            auto consider = [&](size_t index, bool candidate)
+                {
+                    if (!candidate)
+                        return;
+
+                    if (!tables[index])
+                    {
+                        missingTable = true;
+                        return;
+                    }
+
+                    size_t size = 0;
+                    {
+                        std::lock_guard<std::recursive_mutex> lock(tables[index]->ItteratorLock);
+                        size = tables[index]->Size();
+                    }
+
+                    if (size < driverSize)
+                    {
+                        driver = index;
+                        driverSize = size;
+                    }
+                };
+            (consider(I, QueryTerms::Traits<TermAt<I>>::Required && !QueryTerms::IsData<TermAt<I>>), ...);
+        }
+
+        template<class Func, size_t... I>
+        static void DispatchTableDriver(size_t driver, Func& func, const Tables& tables, bool paralel, bool enabledOnly, std::index_sequence<I...>)
+        {
+            auto drive = [&]<size_t D>(std::integral_constant<size_t, D>)
+                {
+                    if constexpr (QueryTerms::Traits<TermAt<D>>::Required && !QueryTerms::IsData<TermAt<D>>)
+                        DriveFromTable<D>(func, tables, paralel, enabledOnly);
+                };
+            ((driver == I ? drive(std::integral_constant<size_t, I>{}) : void()), ...);
+        }
+
+        template<size_t D, class Func>
+        static void DriveFromTable(Func& func, const Tables& tables, bool paralel, bool enabledOnly)
+        {
+            auto* table = static_cast<ComponentTable<ComponentAt<D>>*>(tables[D]);
+            std::lock_guard<std::recursive_mutex> lock(table->ItteratorLock);
+
+            const size_t* entities = table->Index.GetIds().data();
+            ComponentAt<D>* components = table->Components.data();
+            size_t count = table->Components.size();
+
+            auto runBatch = [&](size_t first)
+                {
+                    Batch batch;
+                    std::span<const size_t> batchEntities(entities + first, std::min(BatchSize, count - first));
+
+                    auto& driverColumn = std::get<D>(batch);
+                    for (size_t i = 0; i < batchEntities.size(); i++)
+                        driverColumn[i] = components + first + i;
+
+                    ResolveTerms<D>(batch, tables, batchEntities, nullptr, 0, TermIndices{});
+                    Invoke(func, batch, batchEntities, enabledOnly, TermIndices{});
+                };
+
+            size_t batches = (count + BatchSize - 1) / BatchSize;
+            if (paralel)
+            {
+                TaskManager::ParallelFor(0, batches, 1, [&runBatch](size_t index) { runBatch(index * BatchSize); });
+            }
+            else
+            {
+                for (size_t index = 0; index < batches; index++)
+                    runBatch(index * BatchSize);
+            }
+        }
+
+        template<class Func>
+        static void DriveFromChunks(Func& func, const Tables& tables, const std::vector<size_t>& dataTypes, bool paralel, bool enabledOnly)
+        {
+            ArchetypeStorage::ChunkWalk walk(dataTypes);
+            walk.Run([&](const ArchetypeStorage::ChunkRef& chunk)
+                {
+                    if (HasExcludedColumn(chunk, TermIndices{}))
+                        return;
+
+                    const size_t* entities = chunk.GetEntities();
+                    for (size_t first = 0; first < chunk.Count; first += BatchSize)
+                    {
+                        Batch batch;
+                        std::span<const size_t> batchEntities(entities + first, std::min(BatchSize, chunk.Count - first));
+
+                        ResolveTerms<TermCount>(batch, tables, batchEntities, &chunk, first, TermIndices{});
+                        Invoke(func, batch, batchEntities, enabledOnly, TermIndices{});
+                    }
+                }, paralel);
+        }
+
+        template<size_t... I>
+        static bool HasExcludedColumn(const ArchetypeStorage::ChunkRef& chunk, std::index_sequence<I...>)
+        {
+            auto excluded = [&]<size_t J>(std::integral_constant<size_t, J>)
+                {
+                    if constexpr (QueryTerms::Traits<TermAt<J>>::Excluded && QueryTerms::IsData<TermAt<J>>)
+                        return chunk.Type->FindColumn(ComponentAt<J>::GetComponentId()) >= 0;
+                    else
+                        return false;
+                };
+            return (excluded(std::integral_constant<size_t, I>{}) || ...);
+        }
+
+        // fills every term but the driver, data terms come from the chunk's columns when there is one
+        template<size_t D, size_t... I>
+        static void ResolveTerms(Batch& batch, const Tables& tables, std::span<const size_t> entities, const ArchetypeStorage::ChunkRef* chunk, size_t first, std::index_sequence<I...>)
+        {
+            auto resolve = [&]<size_t J>(std::integral_constant<size_t, J>)
+                {
+                    using T = ComponentAt<J>;
+                    auto& column = std::get<J>(batch);
+
+                    if constexpr (J == D)
+                    {
+                        return;
+                    }
+                    else if constexpr (QueryTerms::IsData<TermAt<J>>)
+                    {
+                        if (chunk)
+                        {
+                            T* components = chunk->template GetColumn<T>();
+                            for (size_t i = 0; i < entities.size(); i++)
+                                column[i] = components ? components + first + i : nullptr;
+                        }
+                        else
+                        {
+                            std::array<void*, BatchSize> resolved;
+                            ArchetypeStorage::Resolve(T::GetComponentId(), entities, resolved.data());
+                            for (size_t i = 0; i < entities.size(); i++)
+                                column[i] = static_cast<T*>(resolved[i]);
+                        }
+                    }
+                    else
+                    {
+                        if (tables[J])
+                            static_cast<ComponentTable<T>*>(tables[J])->Resolve(entities, column.data());
+                        else
+                            std::fill_n(column.begin(), entities.size(), nullptr);
+                    }
+                };
+            (resolve(std::integral_constant<size_t, I>{}), ...);
+        }
+
+        template<size_t I>
+        static auto GetArgument(Batch& batch, size_t index)
+        {
+            auto* component = std::get<I>(batch)[index];
+            if constexpr (QueryTerms::Traits<TermAt<I>>::Excluded)
+                return std::tuple<>();
+            else if constexpr (QueryTerms::Traits<TermAt<I>>::Required)
+                return std::tuple<ComponentAt<I>&>(*component);
+            else
+                return std::tuple<ComponentAt<I>*>(component);
+        }
+
+        template<class Func, size_t... I>
+        static void Invoke(Func& func, Batch& batch, std::span<const size_t> entities, bool enabledOnly, std::index_sequence<I...>)
+        {
+            for (size_t i = 0; i < entities.size(); i++)
+            {
+                bool matches = ((QueryTerms::Traits<TermAt<I>>::Required ? std::get<I>(batch)[i] != nullptr : true) && ...)
+                    && ((QueryTerms::Traits<TermAt<I>>::Excluded ? std::get<I>(batch)[i] == nullptr : true) && ...);
+                if (!matches)
+                    continue;
+
+                if (enabledOnly && !IsEntityEnabled(entities[i]))
+                    continue;
+
+                std::apply(func, std::tuple_cat(GetArgument<I>(batch, i)...));
+            }
+        }
+    };
+}
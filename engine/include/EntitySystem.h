@@ -1,33 +1,53 @@
 #pragma once
 
 #include "CRC64.h"
+#include "ArchetypeStorage.h"
 #include "ResourceManager.h"
 #include "BufferReader.h"
+#include "TaskManager.h"
+#include "SparseSet.h"
 
 #include <functional>
 #include <memory>
 #include <algorithm>
-#include <execution>
 #include <mutex>
 #include <vector>
 #include <span>
 
 #define DECLARE_COMPONENT(CompoentName) \
 static size_t GetComponentId() { return Hashes::CRC64Str(#CompoentName); } \
+static const char* GetComponentName() { return #CompoentName; } \
 size_t ComponentId() const override{ return Hashes::CRC64Str(#CompoentName); }
 
 #define DECLARE_SIMPLE_COMPONENT(CompoentName) \
 static size_t GetComponentId() { return Hashes::CRC64Str(#CompoentName); } \
+static const char* GetComponentName() { return #CompoentName; } \
 size_t ComponentId() const override { return Hashes::CRC64Str(#CompoentName);  } \
 CompoentName(size_t entityId) : EntityComponent(entityId) {}
 
 namespace EntitySystem
 {
+    // entity metadata is dense over [0, MaxEntityId), component tables get a bit each in an entity's mask
+    static constexpr size_t MaxEntityId = size_t(1) << 26;
+    static constexpr size_t MaxComponentTypes = 64;
+
     struct EntityComponent;
 
     EntityComponent* AddComponent(size_t entityId, size_t componentType);
     EntityComponent* GetEntityComponent(size_t entityId, size_t componentType);
 
+    // data components live in ArchetypeStorage, the typed templates below route to it
+    void* AddDataComponent(size_t entityId, size_t componentType);
+
+    template<class T>
+    T* AddComponent(size_t entityId);
+
+    template<class T>
+    T* GetEntityComponent(size_t entityId);
+
+    template<class T>
+    bool EntityHasComponent(size_t entityId);
+
     bool IsEntityReady(size_t entityId);
     bool IsEntityEnabled(size_t entityId);
 
@@ -110,19 +130,19 @@ namespace EntitySystem
         template<class T>
         T* AddComponent()
         {
-            return static_cast<T*>(EntitySystem::AddComponent(EntityID, T::GetComponentId()));
+            return EntitySystem::AddComponent<T>(EntityID);
         }
 
         template<class T>
         T* GetEntityComponent()
         {
-            return static_cast<T*>(EntitySystem::GetEntityComponent(EntityID, T::GetComponentId()));
+            return EntitySystem::GetEntityComponent<T>(EntityID);
         }
 
         template<class T>
         bool EntityHasComponent()
         {
-            return static_cast<T*>(EntitySystem::GetEntityComponent(EntityID, T::GetComponentId()));
+            return EntitySystem::EntityHasComponent<T>(EntityID);
         }
     };
    
@@ -144,30 +164,36 @@ namespace EntitySystem
         virtual ~IComponentTable() = default;
 
         std::recursive_mutex ItteratorLock;
+
+        // smallest number of components handed to a worker by a parallel DoForEach
+        static constexpr size_t ParallelGrainSize = 32;
     };
 
     template<class T>
     struct ComponentTable : public IComponentTable
     {
+        // in Index order
         std::vector<T> Components;
-        std::unordered_map<size_t, size_t> ComponentsByID;
+        SparseSet Index;
 
         size_t GetComponentType() const override { return T::GetComponentId(); }
 
         EntityComponent* Add(size_t id) override
         {
-            std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
-            Components.emplace_back(id);
-            ComponentsByID[id] = Components.size() - 1;
-            return &Components.back();
+            return Add<>(id);
         }
 
+        // an entity has at most one of each component, adding it again returns the existing one
         template<class... Args>
         T* Add(size_t id, Args&&... args)
         {
             std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
+            uint32_t index = Index.Find(id);
+            if (index != SparseSet::Missing)
+                return &Components[index];
+
+            Index.Insert(id);
             Components.emplace_back(id, std::forward<Args>(args)...);
-            ComponentsByID[id] = Components.size() - 1;
             return &Components.back();
         }
 
@@ -175,29 +201,18 @@ namespace EntitySystem
         {
             std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
 
-            auto itr = ComponentsByID.find(id);
-            if (itr == ComponentsByID.end())
+            uint32_t index = Index.Erase(id);
+            if (index == SparseSet::Missing)
                 return;
-            size_t index = itr->second;
 
-            // it's the tail
-            if (index == Components.size() - 1)
+            // it's in the middle, swap and erase like the index did
+            if (index != Components.size() - 1)
             {
-                Components.pop_back();
-                ComponentsByID.erase(itr);
-                return;
+                std::swap(Components[index], Components.back());
+                Components[index].GetReference()->UpdateCache();
             }
 
-            // it's in the middle, swap and erase
-            std::swap(Components[index], Components.back());
-            Components[index].GetReference()->UpdateCache();
-
             Components.pop_back();
-            if (!Components.empty())
-            {
-                ComponentsByID[Components[index].EntityID] = index;
-            }
-            ComponentsByID.erase(itr);
         }
 
         void Clear() override
@@ -208,7 +223,7 @@ namespace EntitySystem
                 component.Dispose();
             }
             Components.clear();
-            ComponentsByID.clear();
+            Index.Clear();
         }
         
         size_t Size() const override
@@ -219,27 +234,38 @@ namespace EntitySystem
         bool HasEntity(size_t id) override
         {
             std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
-            return ComponentsByID.contains(id);
+            return Index.Contains(id);
         }
         
         EntityComponent* Get(size_t id) override
         {
             std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
-            auto itr = ComponentsByID.find(id);
-            if (itr == ComponentsByID.end())
+            uint32_t index = Index.Find(id);
+            if (index == SparseSet::Missing)
                 return Add(id);
 
-            return &Components[itr->second];
+            return &Components[index];
         }
 
         EntityComponent* TryGet(size_t id) override
         {
             std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
-            auto itr = ComponentsByID.find(id);
-            if (itr == ComponentsByID.end())
+            uint32_t index = Index.Find(id);
+            if (index == SparseSet::Missing)
                 return nullptr;
 
-            return &Components[itr->second];
+            return &Components[index];
+        }
+
+        // components[i] is the component of entities[i] or nullptr, one lock for the whole span
+        void Resolve(std::span<const size_t> entities, T** components)
+        {
+            std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
+            for (size_t i = 0; i < entities.size(); i++)
+            {
+                uint32_t index = Index.Find(entities[i]);
+                components[i] = index == SparseSet::Missing ? nullptr : &Components[index];
+            }
         }
 
         void DoForEach(std::function<void(EntityComponent&)> func, bool paralel = false, bool enabledOnly = true) override
@@ -247,9 +273,10 @@ namespace EntitySystem
             std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
             if (paralel)
             {
-                std::for_each(std::execution::par, Components.begin(), Components.end(), [func, enabledOnly]
-                (auto& component)
+                // the join only runs this loop's chunks, so nothing else re-enters the lock on this thread
+                TaskManager::ParallelFor(0, Components.size(), ParallelGrainSize, [this, &func, enabledOnly](size_t index)
                     {
+                        auto& component = Components[index];
                         if (!enabledOnly || IsEntityEnabled(component.EntityID))
                             func(component);
                     });
@@ -267,11 +294,53 @@ namespace EntitySystem
 
         void DoForEach(std::function<void(T&)> func, bool paralel = false, bool enabledOnly = true)
         {
-            std::lock_guard<std::mutex> lock(ItteratorLock);
-            DoForEach([func, enabledOnly](EntityComponent& component)
+            ForEach(func, paralel, enabledOnly);
+        }
+
+        // func(T&) is called directly, no std::function per component
+        template<class Func>
+        void ForEach(Func&& func, bool paralel = false, bool enabledOnly = true)
+        {
+            std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
+
+            auto visit = [&func, enabledOnly](T& component)
+                {
+                    if (!enabledOnly || IsEntityEnabled(component.EntityID))
+                        func(component);
+                };
+
+            // the join only runs this loop's chunks, a task adding to this table waits for the lock instead of
+            // running inside it
+            if (paralel)
+            {
+                TaskManager::ParallelFor(0, Components.size(), ParallelGrainSize, [this, &visit](size_t index) { visit(Components[index]); });
+            }
+            else
+            {
+                for (T& component : Components)
+                    visit(component);
+            }
+        }
+
+        // func(std::span<T>) over contiguous runs of components, disabled entities are not filtered out.
+        // Serial is one span of the whole table, parallel is one span per worker chunk. The lock is held until the
+        // last span is done, as in ForEach.
+        template<class Func>
+        void ForEachChunk(Func&& func, bool paralel = false)
+        {
+            std::lock_guard<std::recursive_mutex> lock(ItteratorLock);
+
+            if (paralel)
+            {
+                TaskManager::ParallelForRange(0, Components.size(), ParallelGrainSize, [this, &func](size_t begin, size_t end)
+                    {
+                        func(std::span<T>(Components.data() + begin, end - begin));
+                    });
+            }
+            else if (!Components.empty())
             {
-                func(static_cast<T&>(component));
-            }, paralel, enabledOnly);
+                func(std::span<T>(Components));
+            }
         }
     };
 
@@ -303,13 +372,13 @@ namespace EntitySystem
     void DoForEachEntityWithComponent(size_t componentType, std::function<void(size_t&)> func, bool paralel = false, bool enabledOnly = true);
     void DoForEachComponent(size_t componentType, std::function<void(EntityComponent&)> func, bool paralel = false, bool enabledOnly = true);
     
-    template<class T>
-    void DoForEachComponent(std::function<void(T&)> func, bool paralel = false, bool enabledOnly = true)
+    template<class T, class Func>
+    void ForEach(Func&& func, bool paralel = false, bool enabledOnly = true);
+
+    template<class T, class Func>
+    void DoForEachComponent(Func&& func, bool paralel = false, bool enabledOnly = true)
     {
-        DoForEachComponent(T::GetComponentId(), [&func](EntityComponent& component)
-        {
-                func(static_cast<T&>(component));
-        }, paralel, enabledOnly);
+        ForEach<T>(std::forward<Func>(func), paralel, enabledOnly);
     }
 
     void DoForeachComponentOfEntity(size_t entityId, std::function<void(EntityComponent&)> func);
@@ -319,13 +388,19 @@ namespace EntitySystem
     template<class T>
     T* GetEntityComponent(size_t entityId)
     {
-        return static_cast<T*>(GetEntityComponent(entityId, T::GetComponentId()));
+        if constexpr (ArchetypeStorage::DataComponent<T>)
+            return static_cast<T*>(ArchetypeStorage::Get(entityId, T::GetComponentId()));
+        else
+            return static_cast<T*>(GetEntityComponent(entityId, T::GetComponentId()));
     }
 
     template<class T>
     bool EntityHasComponent(size_t entityId)
     {
-        return EntityHasComponent(entityId, T::GetComponentId());
+        if constexpr (ArchetypeStorage::DataComponent<T>)
+            return ArchetypeStorage::Has(entityId, T::GetComponentId());
+        else
+            return EntityHasComponent(entityId, T::GetComponentId());
     }
 
     void RegisterComponent(size_t compnentType, std::unique_ptr<IComponentTable> table);
@@ -333,7 +408,10 @@ namespace EntitySystem
     template<class T>
     void RegisterComponent()
     {
-        RegisterComponent(T::GetComponentId(), std::move(std::make_unique<ComponentTable<T>>()));
+        if constexpr (ArchetypeStorage::DataComponent<T>)
+            ArchetypeStorage::RegisterComponent<T>();
+        else
+            RegisterComponent(T::GetComponentId(), std::move(std::make_unique<ComponentTable<T>>()));
     }
 
     IComponentTable* GetComponentTable(size_t componentType);
@@ -342,12 +420,57 @@ namespace EntitySystem
     ComponentTable<T>* GetComponentTable()
     {
         auto* table = GetComponentTable(T::GetComponentId());
-        if (table->GetComponentType() != T::GetComponentId())
+        if (!table || table->GetComponentType() != T::GetComponentId())
             return nullptr;
 
         return static_cast<ComponentTable<T>*>(table);
     }
 
+    // func(T&) for every component of type T, inlined, no std::function per component. Like DoForEach, func must
+    // not add or remove components of T, other tasks that do wait until the loop is done
+    template<class T, class Func>
+    void ForEach(Func&& func, bool paralel, bool enabledOnly)
+    {
+        if constexpr (ArchetypeStorage::DataComponent<T>)
+        {
+            ArchetypeStorage::ForEachChunk<T>([&func, enabledOnly](size_t count, size_t* entities, T* components)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (!enabledOnly || IsEntityEnabled(entities[i]))
+                        func(components[i]);
+                }
+            }, paralel);
+        }
+        else
+        {
+            ComponentTable<T>* table = GetComponentTable<T>();
+            if (table)
+                table->ForEach(func, paralel, enabledOnly);
+        }
+    }
+
+    // func(std::span<T>) over contiguous runs of T, for tight loops that can vectorize. Disabled entities are
+    // not filtered out. Table components come as one span or one per worker chunk, data components as one
+    // span per archetype chunk.
+    template<class T, class Func>
+    void ForEachChunk(Func&& func, bool paralel = false)
+    {
+        if constexpr (ArchetypeStorage::DataComponent<T>)
+        {
+            ArchetypeStorage::ForEachChunk<T>([&func](size_t count, size_t*, T* components)
+            {
+                func(std::span<T>(components, count));
+            }, paralel);
+        }
+        else
+        {
+            ComponentTable<T>* table = GetComponentTable<T>();
+            if (table)
+                table->ForEachChunk(func, paralel);
+        }
+    }
+
     template<class T>
     T* GetFirstComponentOfType()
     {
@@ -361,10 +484,20 @@ namespace EntitySystem
     template<class T, class... Args>
     T* AddComponent(size_t entityId, Args&&... args)
     {
-        ComponentTable<T>* table = GetComponentTable<T>();
-        if (!table)
-            return nullptr;
-        return table->Add(entityId, std::forward<Args>(args)...);
+        if constexpr (ArchetypeStorage::DataComponent<T>)
+        {
+            T* component = AddComponent<T>(entityId);
+            if (component)
+                *component = T{ std::forward<Args>(args)... };
+            return component;
+        }
+        else
+        {
+            ComponentTable<T>* table = GetComponentTable<T>();
+            if (!table)
+                return nullptr;
+            return table->Add(entityId, std::forward<Args>(args)...);
+        }
     }
 
     size_t NewEntityId();
@@ -372,7 +505,10 @@ namespace EntitySystem
     template<class T>
     T* AddComponent(size_t entityId)
     {
-        return static_cast<T*>(AddComponent(entityId, T::GetComponentId()));
+        if constexpr (ArchetypeStorage::DataComponent<T>)
+            return static_cast<T*>(AddDataComponent(entityId, T::GetComponentId()));
+        else
+            return static_cast<T*>(AddComponent(entityId, T::GetComponentId()));
     }
 
     void AwakeAllEntities();
@@ -383,5 +519,7 @@ namespace EntitySystem
 
     void ClearAllEntities();
 
+    // removed entities keep their components until the morgue is flushed, that happens in batches as a
+    // main thread maintenance job, this releases all of them now
     void FlushMorgue();
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+// FlightRecorder.h
+// Always-on ring buffer of the last frames' timings, built into release so production spikes can be inspected.
+// - TaskManager fills one FrameRecord per frame: per stage duration, blocked time, task count and tasks shed
+//   over budget, and the execute time of every registered task that ran
+// - a frame slower than the spike threshold dumps the buffered window to disk, at most once per window
+// - Dump() writes the window on demand
+// - dumps are written as CSV on the worker pool's background I/O lane, the frame only pays for copying the ring
+
+#include "FrameStage.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace FlightRecorder
+{
+    static constexpr size_t FrameCount = 600;
+    static constexpr size_t MaxTasksPerFrame = 128;
+    // indexed by stage id, custom stages included
+    static constexpr size_t StageCount = StageSlotCount;
+
+    struct StageSample
+    {
+        float Duration = 0;
+        float Blocked = 0;
+        uint32_t TaskCount = 0;
+
+        // Optional and Deferrable tasks shed because the stage or frame was over budget
+        uint32_t Skipped = 0;
+        uint32_t Deferred = 0;
+    };
+
+    struct TaskSample
+    {
+        const char* Name = nullptr;
+        size_t TaskId = 0;
+        float Duration = 0;
+    };
+
+    struct FrameRecord
+    {
+        uint64_t FrameIndex = 0;
+
+        // wall time since the previous frame ended, and the part of it spent in TaskManager::TickFrame
+        float FrameTime = 0;
+        float TickTime = 0;
+
+        std::array<StageSample, StageCount> Stages;
+
+        uint32_t TaskCount = 0;
+        std::array<TaskSample, MaxTasksPerFrame> Tasks;
+
+        void AddTask(const char* name, size_t taskId, float duration);
+    };
+
+    // main thread, called by TaskManager::TickFrame
+    FrameRecord& BeginFrame();
+    void EndFrame();
+
+    // frames slower than this (seconds) trigger a dump, 0 disables
+    void SetSpikeThreshold(float seconds);
+    float GetSpikeThreshold();
+
+    // dumps are written to <prefix>_<n>_stages.csv and <prefix>_<n>_tasks.csv
+    void SetDumpPrefix(const std::string& prefix);
+
+    // main thread, writes the buffered window now
+    void Dump(const char* reason);
+
+    // 0 is the last completed frame, nullptr past the recorded window
+    const FrameRecord* GetFrame(size_t framesAgo);
+
+    // waits for dumps in flight, called by TaskManager::Shutdown while the pool is still running
+    void Shutdown();
+}
@@ -0,0 +1,32 @@
+#pragma once
+// FrameSnapshot.h
+// Double buffered frame data handed from the simulation to the render stages.
+// - the simulation fills GetWriteBuffer() during its stages
+// - Publish() swaps the buffers, call it from a TaskManager frame sync callback
+// - render stages only read GetPublished(), which stays immutable until the next Publish()
+
+#include <atomic>
+
+template<typename T>
+class FrameSnapshot
+{
+public:
+    T& GetWriteBuffer()
+    {
+        return Buffers[1 - Published.load(std::memory_order_acquire)];
+    }
+
+    const T& GetPublished() const
+    {
+        return Buffers[Published.load(std::memory_order_acquire)];
+    }
+
+    void Publish()
+    {
+        Published.store(1 - Published.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+
+private:
+    T Buffers[2];
+    std::atomic<int> Published = 0;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 enum class FrameStage : uint8_t
@@ -15,9 +16,43 @@ enum class FrameStage : uint8_t
     Present,
     PostDraw,
     FrameTail,
+
+    // ids for the stages added with TaskManager::DefineStage, see CustomStage()
+    FirstCustomStage,
     AutoNextState = 255
 };
 
+static constexpr size_t MaxCustomStages = 32;
+
+// every stage id a frame can run, built-in and custom
+static constexpr size_t StageSlotCount = size_t(FrameStage::FirstCustomStage) + MaxCustomStages;
+
+// custom stage ids are constants so their definitions can be too, out of range gives None which DefineStage refuses
+constexpr FrameStage CustomStage(size_t index)
+{
+    return index < MaxCustomStages ? FrameStage(size_t(FrameStage::FirstCustomStage) + index) : FrameStage::None;
+}
+
+// A custom stage, registered with TaskManager::DefineStage before tasks use it
+//     static constexpr StageDefinition PhysicsStage{ .Id = CustomStage(0), .Name = "Physics", .After = FrameStage::FixedUpdate, .FixedRate = 120 };
+struct StageDefinition
+{
+    FrameStage Id = FrameStage::None;
+    const char* Name = "Custom";
+
+    // runs right after this stage, which may be another custom stage
+    FrameStage After = FrameStage::Update;
+
+    // steps per second with its own accumulator, 0 runs once per frame
+    float FixedRate = 0;
+
+    // the stage its tasks finish before by default, AutoNextState is the stage that follows it
+    FrameStage Blocks = FrameStage::AutoNextState;
+};
+
+// kept by TaskManager with the stage order
+const char* GetCustomStageName(FrameStage state);
+
 // Operator overloads for GameState to use in for loops
 inline FrameStage& operator++(FrameStage& state)
 {
@@ -68,25 +103,9 @@ static constexpr const char* GetStageName(FrameStage state)
     case FrameStage::PostDraw: return "PostDraw";
     case FrameStage::FrameTail: return "FrameTail";
     case FrameStage::AutoNextState: return "AutoNext";
-    default: return "Unknown";
-    }
-}
-
-static FrameStage GetNextStage(FrameStage state)
-{
-    switch (state)
-    {
-    case FrameStage::FrameHead: return FrameStage::PreUpdate;
-    case FrameStage::PreUpdate: return FrameStage::Update;
-    case FrameStage::Update: return FrameStage::PostUpdate;
-    case FrameStage::FixedUpdate: return FrameStage::PostUpdate;
-    case FrameStage::PostUpdate: return FrameStage::PreDraw;
-    case FrameStage::PreDraw: return FrameStage::Draw;
-    case FrameStage::Draw: return FrameStage::Present;
-    case FrameStage::Present: return FrameStage::PostDraw;
-    case FrameStage::PostDraw: return FrameStage::FrameTail;
-    case FrameStage::FrameTail: return FrameStage::FrameHead;
-    default: return FrameStage::None;
+    default: return GetCustomStageName(state);
     }
 }
 
+// the stage tasks started in state block unless they set their own, defining a custom stage can change it
+FrameStage GetNextStage(FrameStage state);
@@ -1,8 +1,9 @@
 
 #pragma once
 // ResourceManager.h
-// Simple resource manager that loads Image, Music (Wave) and raw File data using a pool of ThreadedProcessor workers.
-// - 4 concurrent loader threads
+// Simple resource manager that loads Image, Music (Wave) and raw File data on the TaskManager worker pool.
+// - the file is read on the background I/O lane and decoded on the background decode lane, loads run inline
+//   when the pool is not running
 // - resources identified by size_t hash
 // - returns std::shared_ptr<ResourceInfo> immediately; ResourceInfo::Ready indicates load completion
 // - ResourceInfo keeps a use count; call Release() when done to allow automatic unload
@@ -13,6 +14,7 @@
 #include "ThreadedProcessor.h"
 #include "raylib.h"
 
+#include <coroutine>
 #include <memory>
 #include <string>
 #include <functional>
@@ -77,19 +79,42 @@ namespace ResourceManager
         ResourceInfo& operator=(const ResourceInfo&) = delete;
     };
 
-    // Initialize ResourceManager and start loader pool (call once)
+    // Initialize ResourceManager (call once, after TaskManager::Init)
     void Init();
 
-    // Shutdown loader pool and unload all resources (call on shutdown)
+    // Wait for loads in flight and unload all resources (call on shutdown, before TaskManager::Shutdown)
     void Shutdown();
 
     // Poll for completed loads and invoke callbacks (call from main thread regularly)
     void Update();
 
+    // Optional: hand finished loads to this instead of queuing them for Update(). It is called on a pool
+    // worker and must run the closure on the main thread, e.g. through TaskManager::PostToMainThread.
+    // Set before Init.
+    using MainThreadDispatcher = std::function<void(std::function<void()>)>;
+    void SetMainThreadDispatcher(MainThreadDispatcher dispatcher);
+
     // Load or obtain existing resource info by hash and type. Optional onLoaded callback is invoked when load completes.
     // Returns a shared_ptr<ResourceInfo> immediately. Caller should call Release() when finished with the resource.
     ResourceInfoRef LoadResource(size_t hash, ResourceType type, OnLoadedCb onLoaded = nullptr);
 
-    // Internal: called by ResourceInfo::Release to free resource memory and remove from map when not used.
+    // Awaitable returned by LoadResourceAsync; resumes the coroutine on the thread that finishes loads
+    // (the main thread) and yields the ResourceInfoRef. Like LoadResource, the caller holds one use.
+    struct ResourceAwaiter
+    {
+        size_t Hash = 0;
+        ResourceType Type = ResourceType::File;
+        ResourceInfoRef Info = nullptr;
+
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> handle);
+        ResourceInfoRef await_resume() { return Info; }
+    };
+
+    // co_await LoadResourceAsync(hash) from a Coroutine, see Coroutine.h
+    ResourceAwaiter LoadResourceAsync(size_t hash, ResourceType type = ResourceType::File);
+
+    // Internal: called by ResourceInfo::Release to remove the resource from the map when not used, its memory is
+    // freed by a pool maintenance job.
     void ReleaseResourceById(size_t id);
 }
\ No newline at end of file
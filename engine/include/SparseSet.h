@@ -0,0 +1,122 @@
+#pragma once
+// SparseSet.h
+// Paged sparse set mapping entity ids to dense indices.
+// - the sparse side is an array of pages indexed by the high bits of the id, a page of dense indices is
+//   allocated the first time an id in its range is inserted and kept until Clear
+// - lookups are a shift, a mask and two loads, no hashing and no allocation per entry
+// - the dense side is the id list, the owner keeps its own dense arrays in the same order and mirrors the
+//   swap that Erase does
+// - ids past the paged range (ids read from a file can be anything) go to an overflow map
+// - not thread safe, the owner locks
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+class SparseSet
+{
+public:
+    static constexpr uint32_t Missing = UINT32_MAX;
+
+    static constexpr size_t PageBits = 12;
+    static constexpr size_t PageSize = size_t(1) << PageBits;
+    static constexpr size_t MaxPagedId = size_t(1) << 32;
+
+    uint32_t Find(size_t id) const
+    {
+        if (id >= MaxPagedId) [[unlikely]]
+            return FindOverflow(id);
+
+        size_t page = id >> PageBits;
+        if (page >= Pages.size() || !Pages[page])
+            return Missing;
+
+        return (*Pages[page])[id & (PageSize - 1)];
+    }
+
+    bool Contains(size_t id) const
+    {
+        return Find(id) != Missing;
+    }
+
+    // the id must not be in the set, returns its dense index, always the back
+    uint32_t Insert(size_t id)
+    {
+        uint32_t index = uint32_t(Dense.size());
+        Dense.push_back(id);
+        SetIndex(id, index);
+        return index;
+    }
+
+    // moves the last id into the erased slot, returns the slot or Missing. The owner does the same swap
+    // and pop on its dense arrays.
+    uint32_t Erase(size_t id)
+    {
+        uint32_t index = Find(id);
+        if (index == Missing)
+            return Missing;
+
+        size_t last = Dense.back();
+        Dense[index] = last;
+        Dense.pop_back();
+
+        if (last != id)
+            SetIndex(last, index);
+        SetIndex(id, Missing);
+
+        return index;
+    }
+
+    void Clear()
+    {
+        Pages.clear();
+        Overflow.clear();
+        Dense.clear();
+    }
+
+    size_t Size() const { return Dense.size(); }
+    std::span<const size_t> GetIds() const { return Dense; }
+
+private:
+    using Page = std::array<uint32_t, PageSize>;
+
+    std::vector<std::unique_ptr<Page>> Pages;
+    std::unordered_map<size_t, uint32_t> Overflow;
+    std::vector<size_t> Dense;
+
+    uint32_t FindOverflow(size_t id) const
+    {
+        auto itr = Overflow.find(id);
+        return itr == Overflow.end() ? Missing : itr->second;
+    }
+
+    void SetIndex(size_t id, uint32_t index)
+    {
+        if (id >= MaxPagedId) [[unlikely]]
+        {
+            if (index == Missing)
+                Overflow.erase(id);
+            else
+                Overflow.insert_or_assign(id, index);
+            return;
+        }
+
+        size_t page = id >> PageBits;
+        if (page >= Pages.size())
+            Pages.resize(page + 1);
+
+        if (!Pages[page])
+        {
+            if (index == Missing)
+                return;
+
+            Pages[page] = std::make_unique_for_overwrite<Page>();
+            Pages[page]->fill(Missing);
+        }
+
+        (*Pages[page])[id & (PageSize - 1)] = index;
+    }
+};
@@ -2,34 +2,89 @@
 
 #include "FrameStage.h"
 #include "CRC64.h"
+#include "TaskCounter.h"
 
 #include <vector>
 #include <atomic>
+#include <cstdint>
 #include <memory>
 #include <functional>
 
 #define DECLARE_TASK(TaskName) \
  size_t TaskId() override { return Hashes::CRC64Str(#TaskName); } \
- static size_t GetTaskId() { return Hashes::CRC64Str(#TaskName); }
+ static size_t GetTaskId() { return Hashes::CRC64Str(#TaskName); } \
+ const char* GetTaskName() override { return #TaskName; }
+
+// when a dependency runs relative to its parent's Tick()
+enum class DependencyTiming : uint8_t
+{
+    AfterParent,
+    BeforeParent,
+};
+
+// Worker pool QoS class. The frame lanes are always served first, the background lanes run on at most
+// ThreadTopology::MaxBackgroundWorkers workers while a frame is in flight and on every worker between frames.
+enum class TaskLane : uint8_t
+{
+    // stage tasks, forks and joins, on the work stealing deques
+    FrameCritical,
+
+    // frame work that can wait behind the critical lane
+    FrameNormal,
+
+    // file reads and other blocking calls
+    BackgroundIO,
+
+    // decoding and parsing of loaded data
+    BackgroundDecode,
+
+    // runs once the other lanes are empty
+    Idle,
+};
+
+static constexpr size_t TaskLaneCount = size_t(TaskLane::Idle) + 1;
+
+// what the scheduler may do with a task when its stage or the frame is over budget
+enum class TaskImportance : uint8_t
+{
+    // always runs
+    Required,
+
+    // may slip to the next frame, but is never shed two frames in a row
+    Deferrable,
+
+    // may be skipped every frame the budget is blown
+    Optional,
+};
 
 class Task
 {
 protected:
-    std::atomic<bool> Completed = false;
-
     virtual void Tick() = 0;
 
     FrameStage BlocksStage = FrameStage::AutoNextState;
+
+    // joins the dependencies forked by Execute
+    TaskCounter DependencyCounter;
+
+    std::vector<Task*> Predecessors;
+
+    void RunDependencies(DependencyTiming timing);
 public:
     virtual size_t TaskId() = 0;
 
+    // shown in trace captures, must outlive the capture
+    virtual const char* GetTaskName() { return "Task"; }
+
     Task() = default;
     Task(FrameStage startStage, bool mainTherad) : StartingStage(startStage), RunInMainThread(mainTherad) {}
+    virtual ~Task() = default;
 
     void Execute();
 
     bool IsComplete();
 
+    // dependencies are forked to the worker pool as a group and joined before the parent completes
     template<typename T, typename... Args>
     T* AddDependency(Args&&... args)
     {
@@ -39,6 +94,15 @@ public:
         return taskPtr;
     }
 
+    // same as AddDependency but the group is run and joined before the parent's Tick()
+    template<typename T, typename... Args>
+    T* AddPreDependency(Args&&... args)
+    {
+        T* taskPtr = AddDependency<T>(std::forward<Args>(args)...);
+        taskPtr->Timing = DependencyTiming::BeforeParent;
+        return taskPtr;
+    }
+
     template<typename T>
     T* GetTask()
     {
@@ -58,16 +122,87 @@ public:
    
     FrameStage GetBlocksStage();
 
+    // AutoNextState blocks the stage after StartingStage
+    void SetBlocksStage(FrameStage stage);
+
+    // Runs this task once predecessor has finished in the same frame. A worker task with predecessors is
+    // dispatched by them as soon as the last one finishes, whatever its StartingStage, and still blocks
+    // its BlocksStage. A main thread task still runs at its StartingStage and waits for them there.
+    // Both tasks must be registered with TaskManager, edges that could deadlock are dropped with a warning.
+    void After(Task* predecessor);
+    const std::vector<Task*>& GetPredecessors() const { return Predecessors; }
+    void RemovePredecessor(Task* predecessor);
+
     bool RunInMainThread = false;
 
+    DependencyTiming Timing = DependencyTiming::AfterParent;
+
+    // the task can integrate several fixed steps in one Tick by scaling with TaskManager::GetFixedStepCount()
+    bool StepIndependent = false;
+
+    // which pool queue SubmitTask puts the task in
+    TaskLane Lane = TaskLane::FrameCritical;
+
+    // created by TaskManager::Post, the pool deletes it once it has run
+    bool OwnedByPool = false;
+
+    // a shed task counts off its stage and releases its successors as if it had run
+    TaskImportance Importance = TaskImportance::Required;
+
+    // TaskManager frame index the scheduler last shed the task in
+    uint64_t ShedFrame = UINT64_MAX;
+
+    // set by the scheduler, times Tick runs in this dispatch when fixed steps are batched
+    uint32_t StepRepeats = 1;
+
     std::vector<std::unique_ptr<Task>> Dependencies;
-    std::atomic<bool> TickedThisFrame = false;
+
+    // smoothed seconds per frame, and the dispatch priority derived from it (longest path to the frame end)
+    float PredictedDuration = 0;
+    float Priority = 0;
+
+    // set by the scheduler when the task is dispatched, released once Execute finishes
+    TaskCounter* CompletionCounter = nullptr;
+
+    // the fixed step this dispatch belongs to, released last so the next step can dispatch the task again
+    TaskCounter* StepCounter = nullptr;
+
+    // counter of the stage this task blocks, cached when the schedule is compiled
+    TaskCounter* StageCounter = nullptr;
+
+    // compiled from the After() edges: the tasks this one releases when Execute finishes, how many
+    // predecessors hold it each frame, and whether they dispatch it instead of its stage
+    std::vector<Task*> Successors;
+    uint32_t PredecessorCount = 0;
+    bool ReleasedByPredecessors = false;
+
+    // Execute ran during the current TaskManager frame
+    bool WasTickedThisFrame() const;
+
+protected:
+    // written by whichever thread runs the task while the dispatcher reads the fields above,
+    // so they start a cache line of their own
+    alignas(64) std::atomic<bool> Completed = false;
+
+public:
+    // TaskManager frame index of the last Execute
+    std::atomic<uint64_t> LastTickedFrame = UINT64_MAX;
+
+    // nanoseconds spent in Execute during LastTickedFrame, including joined dependencies
+    std::atomic<int64_t> ExecuteTime = 0;
+
+    // TaskCounter::Now() when Execute last finished
+    std::atomic<int64_t> FinishTime = 0;
+
+    // predecessors that haven't finished this frame, released from their threads
+    TaskCounter PendingPredecessors;
 };
 
 class LambdaTask : public Task
 {
 private:
     size_t TaskHash = 0;
+    const char* TaskName = "LambdaTask";
     std::function<void()> TickFunction;
 
 protected:
@@ -85,7 +220,14 @@ public:
         StartingStage = FrameStage::None;
     }
 
+    LambdaTask(size_t taskHash, const char* taskName, std::function<void()> tick, bool useMainThread = false)
+        : LambdaTask(taskHash, tick, useMainThread)
+    {
+        TaskName = taskName;
+    }
+
     size_t TaskId() override { return TaskHash; }
+    const char* GetTaskName() override { return TaskName; }
 };
 
 
@@ -0,0 +1,60 @@
+#pragma once
+// TaskCounter.h
+// Outstanding work counter that a thread can block on without polling.
+// - Add() before handing work out, Release() once per finished item
+// - Wait() parks on the counter with std::atomic::wait (futex on Linux, WaitOnAddress on Windows)
+// - every Release() stamps the time before decrementing, so after Wait() returns ReleaseTime holds
+//   the moment the last item finished and the waiter can measure its own wake latency
+// - each counter has its own cache line, the stage counters sit in one array and are released from every worker
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct alignas(64) TaskCounter
+{
+    std::atomic<uint32_t> Pending = 0;
+    std::atomic<int64_t> ReleaseTime = 0;
+
+    static int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Add(uint32_t count = 1)
+    {
+        Pending.fetch_add(count, std::memory_order_acq_rel);
+    }
+
+    // true for the Release() that brought the counter to zero
+    bool Release()
+    {
+        ReleaseTime.store(Now(), std::memory_order_relaxed);
+        if (Pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return false;
+
+        Pending.notify_all();
+        return true;
+    }
+
+    bool IsDone() const
+    {
+        return Pending.load(std::memory_order_acquire) == 0;
+    }
+
+    void Wait() const
+    {
+        uint32_t pending = Pending.load(std::memory_order_acquire);
+        while (pending != 0)
+        {
+            Pending.wait(pending, std::memory_order_acquire);
+            pending = Pending.load(std::memory_order_acquire);
+        }
+    }
+
+    // seconds between the last Release() and now
+    double GetWakeLatency() const
+    {
+        return double(Now() - ReleaseTime.load(std::memory_order_relaxed)) / 1e9;
+    }
+};
@@ -1,14 +1,17 @@
 #pragma once
 
 #include "Task.h"
+#include "WorkStealingQueue.h"
 
 #include <atomic>
-#include <deque>
 #include <functional>
 #include <thread>
 #include <algorithm>
 #include <mutex>
 #include <condition_variable>
+#include <coroutine>
+#include <span>
+#include <string>
 
 class ThreadInfo
 {
@@ -21,25 +24,38 @@ private:
 public:
     size_t ThreadId = 0;
     std::thread Thread;
-    std::deque<Task*> Tasks;
-    std::condition_variable Trigger;
-    std::mutex  Lock;
-    std::mutex  TaskLock;
+
+    std::string Name;
+
+    // core the worker pins itself to when it starts, -1 leaves it to the OS
+    int PinnedCore = -1;
+
+    // only this worker pushes and pops, every other thread steals
+    WorkStealingQueue<Task*> Tasks;
 
     std::atomic<bool> IsProcessing = false;
 
+    // reclaim epoch seen before this worker last looked for a task, UINT64_MAX while idle
+    std::atomic<uint64_t> PinnedEpoch = UINT64_MAX;
+
+    // how this worker's idle periods ended: work showed up while spinning, while yielding, or it parked
+    std::atomic<uint64_t> SpinHits = 0;
+    std::atomic<uint64_t> YieldHits = 0;
+    std::atomic<uint64_t> Parks = 0;
+
     std::function<void(Task*)> OnTaskComplete;
 
     std::function<void(size_t)> OnThreadAbort;
 
-    ThreadInfo();
+    ThreadInfo(size_t threadId);
     ~ThreadInfo();
 
+    void Start();
+
     void AbortTasks();
 
     bool IsIdle();
-
-    void AddTask(Task* task);
+    bool IsRunning();
 };
 
 #if defined(DEBUG)
@@ -55,30 +71,194 @@ struct FrameStageStats
     double MaxDurration = 0;
     double MaxBlockedDurration = 0;
 
+    // Optional and Deferrable tasks shed this frame because the stage or the frame was over budget
+    uint32_t SkippedTasks = 0;
+    uint32_t DeferredTasks = 0;
+    uint64_t TotalSkippedTasks = 0;
+    uint64_t TotalDeferredTasks = 0;
+
+    // pool tasks the main thread ran while it waited for the stage, and the time it spent on them
+    uint32_t HelpedTasks = 0;
+    double HelpedDurration = 0;
+
+    // time from the last blocker finishing until the main thread resumed
+    double WakeLatency = 0;
+    double MaxWakeLatency = 0;
+
     bool TickedThisFrame = false;
+
+    // predicted time for the stage's tasks from dispatch to the last one finishing, and what it took
+    double PredictedMakespan = 0;
+    double Makespan = 0;
+
+    // fixed update only, steps run this frame and simulation time dropped by the step cap
+    uint32_t FixedSteps = 0;
+    uint32_t MaxFixedSteps = 0;
+    double DroppedTime = 0;
+    double TotalDroppedTime = 0;
 };
 #endif
 
+// how the worker pool is laid out over the machine, passed to TaskManager::Init
+struct ThreadTopology
+{
+    // 0 uses every hardware thread that isn't reserved
+    size_t WorkerCount = 0;
+
+    // hardware threads kept free of workers for the main thread and the texture loader,
+    // they are the first cores so the workers start after them
+    size_t ReservedCores = 2;
+
+    // pin each worker to its own core, the main and loader threads are pinned to the reserved cores
+    bool PinThreads = false;
+
+    // workers are named "<prefix> <index>" for debuggers, profilers and trace captures
+    std::string WorkerNamePrefix = "Worker";
+
+    // workers that may run background and idle lane tasks while a frame is in flight, between frames
+    // (and while the main thread waits on the swap) every worker may
+    size_t MaxBackgroundWorkers = 1;
+};
+
+enum class WorkerIdleMode : uint8_t
+{
+    // spin, then yield, then park
+    SpinThenPark,
+
+    // park as soon as the queues are empty, saves power at the cost of a wake up per stage
+    PowerSave,
+
+    // power save while the frames have slack, spin while they don't
+    Adaptive,
+};
+
+// what a worker does when it runs out of tasks, set with TaskManager::SetIdlePolicy
+struct WorkerIdlePolicy
+{
+    WorkerIdleMode Mode = WorkerIdleMode::SpinThenPark;
+
+    // polling the queues with a pause between checks, work that shows up in this window skips the futex wake
+    float SpinMicroseconds = 50.0f;
+
+    // std::this_thread::yield rounds after spinning before the worker parks
+    uint32_t YieldCount = 4;
+
+    // Adaptive: the previous frame was slack when TickFrame took less than this share of the frame time
+    float SlackThreshold = 0.5f;
+};
+
+struct WorkerIdleStats
+{
+    uint64_t SpinHits = 0;
+    uint64_t YieldHits = 0;
+    uint64_t Parks = 0;
+};
+
+// per frame limits for maintenance jobs, set with TaskManager::SetMaintenancePolicy
+struct MaintenancePolicy
+{
+    // seconds the pool's idle lane and the main thread may each spend on maintenance per frame
+    float FrameBudget = 0.001f;
+
+    // past its first step the main thread only keeps going while the frame has slack: it waited on the swap,
+    // or the frame took less than this
+    float TargetFrameTime = 1.0f / 60.0f;
+};
+
+// how the fixed update catches up after a long frame
+struct FixedStepPolicy
+{
+    // steps allowed per frame, accumulated time beyond this is dropped so the simulation runs slower
+    // than wall time instead of every later frame being slow too (spiral of death)
+    uint32_t MaxStepsPerFrame = 4;
+
+    // when several steps are due, run the stage once: StepIndependent tasks integrate all of them in one
+    // Tick using GetFixedStepCount(), every other task repeats its Tick once per step on its worker
+    bool BatchCatchUp = false;
+};
+
 namespace TaskManager
 {
     extern std::vector<std::unique_ptr<Task>> Tasks;
 
+    // FixedUpdate's default rate
     static constexpr float FixedFPS = 50.0f;
 
-    void Init();
+    // the stages from the first simulation stage up to the first render stage produce simulation output,
+    // custom stages between them included, the render stages consume it
+    static constexpr FrameStage FirstSimulationStage = FrameStage::FixedUpdate;
+    static constexpr FrameStage FirstRenderStage = FrameStage::PreDraw;
+
+    void Init(const ThreadTopology& topology = ThreadTopology{});
     void Shutdown();
 
+    const ThreadTopology& GetTopology();
+
+    // Main thread inbox: any thread can post a closure that runs on the main thread when the given stage
+    // starts, before the stage's tasks are dispatched. Closures posted for a pipelined simulation stage run
+    // once the simulation joins, posts for a stage that already started this frame run next frame.
+    void PostToMainThread(FrameStage stage, std::function<void()> callback);
+
+    // coroutine resumption on the main thread, used by the awaitables in Coroutine.h
+    // a stage resume follows the same rules as PostToMainThread, a frame resume runs at the start of the
+    // frame that is frameCount frames after the current one
+    void ResumeAtStage(FrameStage stage, std::coroutine_handle<> handle);
+    void ResumeAfterFrames(uint32_t frameCount, std::coroutine_handle<> handle);
+
+    // frames started since Init
+    uint64_t GetFrameIndex();
+
     void TickFrame();
 
-    void CacheStageTask(Task* task);
+    // Splices a custom stage into the frame after definition.After, see StageDefinition. Tasks on it block the
+    // stage that followed it unless it says otherwise, and a fixed rate is only allowed before the render stages.
+    // Main thread between frames, waits for the frame tail tasks and recompiles the schedule at the next frame.
+    bool DefineStage(const StageDefinition& definition);
+
+    // the stages in the order a frame runs them, valid until the next DefineStage
+    std::span<const FrameStage> GetStageOrder();
+
+    // built-in stages past None and the defined custom stages
+    bool IsStageDefined(FrameStage stage);
+
+    // Fixed-rate loops: a stage with a rate runs once per step due on its own accumulator, every loop shares
+    // the FixedStepPolicy. FixedUpdate runs at FixedFPS until changed, 0 turns a loop back into a per frame stage.
+    // Main thread between frames, only stages after FrameHead and before the render stages can step.
+    bool SetFixedRate(FrameStage stage, float stepsPerSecond);
+    float GetFixedRate(FrameStage stage);
+    bool IsFixedStage(FrameStage stage);
+
+    // Pipelined frames: the simulation stages of this frame run on the worker pool while the main thread
+    // runs the render stages against the last published snapshot, at the cost of one frame of latency.
+    // Main thread tasks in the simulation stages run on the main thread after the simulation joins.
+    // Takes effect at the start of the next TickFrame.
+    void SetPipelinedFrames(bool enabled);
+    bool IsPipelinedFrames();
+
+    // called on the main thread once the simulation output for a frame is complete and nothing is
+    // writing it, this is where render snapshots are published
+    void AddFrameSyncCallback(std::function<void()> callback);
+
+    // Registration is lock-free and deferred, so any thread can add or remove tasks, including tasks running
+    // in the current frame. On the main thread between frames a change is applied right away, from anywhere
+    // else it is queued and applied at the next frame boundary. Tasks without edges are spliced into or out of
+    // the compiled schedule directly, anything else recompiles it. A removed task leaves the schedule at the
+    // boundary and is freed once no worker can still be running it. Off the main thread, set a task up (edges,
+    // importance) before handing it to AddTask, the boundary may apply it at any point after.
+    void AddTask(std::unique_ptr<Task> task);
+    void RemoveTask(Task* task);
+    void RemoveTasksWithId(size_t taskId);
+    void InvalidateSchedule();
+
+    // called by Task::Execute, counts the task off its successors and dispatches the ones it was holding last
+    void ReleaseSuccessors(Task* task);
 
     template<typename T, typename... Args>
     T* AddTask(Args&&... args)
     {
         auto task = std::make_unique<T>(std::forward<Args>(args)...);
         T* taskPtr = task.get();
-        CacheStageTask(taskPtr);
-        Tasks.push_back(std::move(task));
+        AddTask(std::unique_ptr<Task>(std::move(task)));
         return taskPtr;
     }
 
@@ -88,22 +268,17 @@ namespace TaskManager
         auto task = std::make_unique<T>(std::forward<Args>(args)...);
         task->StartingStage = stage;
         T* taskPtr = task.get();
-        CacheStageTask(taskPtr);
-        Tasks.push_back(std::move(task));
+        AddTask(std::unique_ptr<Task>(std::move(task)));
         return taskPtr;
     }
 
     template<typename T>
     void RemoveTask()
     {
-        size_t taskId = T::GetTaskId();
-        Tasks.erase(std::remove_if(Tasks.begin(), Tasks.end(),
-            [taskId](const std::unique_ptr<Task>& task)
-            {
-                return task->TaskId() == taskId;
-            }), Tasks.end());
+        RemoveTasksWithId(T::GetTaskId());
     }
 
+    // main thread, a task queued from another thread is found once its add has been applied
     template<typename T>
     T* GetTask()
     {
@@ -117,16 +292,108 @@ namespace TaskManager
     }
 
     bool IsStageBlocked(FrameStage stage);
-    void AdvanceThreadIndex();
+
+    // Budgets in seconds, 0 disables. A stage sheds its Optional and Deferrable tasks when its predicted makespan
+    // is over its budget, or when the frame so far plus the predicted makespan of the stages left is over the
+    // frame budget. Tasks dispatched by their predecessors are checked against their StartingStage.
+    void SetStageBudget(FrameStage stage, float seconds);
+    float GetStageBudget(FrameStage stage);
+    void SetFrameBudget(float seconds);
+    float GetFrameBudget();
+
+    // the main thread runs queued pool tasks for up to the help slice before it parks on the stage
+    void WaitForStage(FrameStage stage);
+
+    // seconds per stage wait, 0 parks right away
+    void SetMainThreadHelpSlice(float seconds);
+    float GetMainThreadHelpSlice();
     void RunTasksForStage(FrameStage state);
 
+    // queue tasks on the worker pool, from the main thread or a worker the tasks go into the
+    // calling thread's own deque and idle workers steal them
+    // tasks outside the FrameCritical lane go to the shared queue of their lane
+    void SubmitTask(Task* task);
+    void SubmitTasks(std::span<Task*> tasks);
+
+    // runs work on the pool in the given lane, the job is created and freed by the pool
+    // runs inline when the pool is not running, name must outlive trace captures
+    void Post(TaskLane lane, std::function<void()> work, const char* name = "Job");
+
+    // runs pool work on the calling thread until the counter reaches zero (fork/join)
+    void WaitForCounter(TaskCounter& counter);
+
+    // Housekeeping spread over frames. step does one bounded slice of the job and returns true while there is
+    // more, it is called again (this frame while there is budget, otherwise a later one) until it returns false.
+    // Pool jobs run on the Idle lane and may overlap a frame, so they must not touch what the frame's tasks use.
+    // Main thread jobs run at the end of TickFrame once every stage has finished, the last stage's worker tasks
+    // included, at least one step per frame.
+    // Pool jobs run on the main thread when there is no pool, jobs still queued at Shutdown run to completion.
+    void AddMaintenanceJob(const char* name, std::function<bool()> step, bool mainThread = false);
+
+    void SetMaintenancePolicy(const MaintenancePolicy& policy);
+    MaintenancePolicy GetMaintenancePolicy();
+
+    size_t GetWorkerCount();
+
+    void SetIdlePolicy(const WorkerIdlePolicy& policy);
+    WorkerIdlePolicy GetIdlePolicy();
+
+    // summed over every worker when worker is SIZE_MAX
+    WorkerIdleStats GetIdleStats(size_t worker = SIZE_MAX);
+
+    // Splits [begin, end) into chunks of at least grain items. Idle workers and the calling thread claim
+    // chunks until the range is exhausted, chunks start large and shrink as the range drains.
+    // Runs inline when the pool is not running or the range fits in one chunk.
+    // The caller only runs and waits on chunks of its own range, never other pool tasks, so it may hold a
+    // lock that func does not take. Helpers that start after the range is done return without calling func.
+    void ParallelForRange(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& func);
+
+    template<typename Func>
+    void ParallelFor(size_t begin, size_t end, size_t grain, Func&& func)
+    {
+        ParallelForRange(begin, end, grain, [&func](size_t chunkBegin, size_t chunkEnd)
+            {
+                for (size_t i = chunkBegin; i < chunkEnd; i++)
+                    func(i);
+            });
+    }
+
+    // reduce must be associative and commutative, chunks are combined in completion order
+    template<typename T, typename MapFunc, typename ReduceFunc>
+    T ParallelReduce(size_t begin, size_t end, size_t grain, T identity, MapFunc&& map, ReduceFunc&& reduce)
+    {
+        std::mutex resultLock;
+        T result = identity;
+        ParallelForRange(begin, end, grain, [&](size_t chunkBegin, size_t chunkEnd)
+            {
+                T partial = identity;
+                for (size_t i = chunkBegin; i < chunkEnd; i++)
+                    partial = reduce(partial, map(i));
+
+                std::lock_guard<std::mutex> lock(resultLock);
+                result = reduce(result, partial);
+            });
+        return result;
+    }
+
     void RunOneShotTask(Task* task);
 
     bool IsIdle();
 
     void AbortAll();
 
-    inline float GetFixedDeltaTime() { return 1.0f / FixedFPS; }
+    // seconds per step of the stage's fixed loop, 0 for a stage that runs once per frame
+    float GetFixedDeltaTime(FrameStage stage = FrameStage::FixedUpdate);
+
+    void SetFixedStepPolicy(const FixedStepPolicy& policy);
+    const FixedStepPolicy& GetFixedStepPolicy();
+
+    // fixed steps a StepIndependent task has to integrate in the stage's current pass, 1 unless batching
+    uint32_t GetFixedStepCount(FrameStage stage = FrameStage::FixedUpdate);
+
+    // the part of a step left on the stage's accumulator after its last pass [0, 1), for drawing state
+    // stepped at that rate between its last two steps
+    float GetFixedAlpha(FrameStage stage = FrameStage::FixedUpdate);
 
 #if defined(DEBUG)
     FrameStageStats& GetStatsForStage(FrameStage state);
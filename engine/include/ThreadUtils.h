@@ -0,0 +1,42 @@
+#pragma once
+// ThreadUtils.h
+// Platform thread naming, core pinning and the spin loop hint.
+// - the implementation includes the OS headers, so it lives in its own translation unit away from raylib
+// - pinning is best effort, it returns false where the platform has no affinity API (macOS)
+// - the reserved core range is set by TaskManager::Init for the main and loader threads
+
+#include <cstddef>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+namespace ThreadUtils
+{
+    size_t GetHardwareThreadCount();
+
+    // shown in debuggers and profilers, Linux truncates to 15 characters
+    void SetCurrentThreadName(const char* name);
+
+    // pin the calling thread to cores [firstCore, firstCore + count)
+    bool PinCurrentThread(size_t firstCore, size_t count = 1);
+
+    void SetReservedCores(size_t firstCore, size_t count);
+
+    // pin the calling thread to the reserved range, false when nothing is reserved
+    bool PinCurrentThreadToReservedCores();
+
+    // spin loop hint, lets the sibling hyperthread run and saves power while polling
+    inline void CpuRelax()
+    {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(_M_ARM64)
+        __yield();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+}
@@ -8,6 +8,8 @@
 // - processing callable is supplied at construction time (or later via SetProcessorAndStart)
 // - safe stop/join in destructor
 // - optional thread lifecycle callbacks: OnThreadStart, OnThreadStop
+// - optional name, used for the OS thread and for its work items in trace captures
+// - optional completion callback, called on the worker thread instead of queuing the result
 
 #include <deque>
 #include <mutex>
@@ -18,6 +20,9 @@
 #include <utility>
 #include <cassert>
 
+#include "Trace.h"
+#include "ThreadUtils.h"
+
 #include <iostream>
 #include <chrono>
 #include <vector>
@@ -157,6 +162,19 @@ public:
         OnThreadStop = std::move(cb);
     }
 
+    // Set a callback that receives each result on the worker thread instead of the completed queue.
+    // Call before starting.
+    void SetOnCompleted(std::function<void(T&&)> cb)
+    {
+        OnCompleted = std::move(cb);
+    }
+
+    // Set the name shown in trace captures; call before starting, must outlive the processor.
+    void SetName(const char* name)
+    {
+        Name = name;
+    }
+
     // Set processor function and start the worker thread.
     // Returns true if the thread was started, false if already running or already started before.
     template<typename F>
@@ -186,6 +204,9 @@ public:
 private:
     void ThreadMain()
     {
+        ThreadUtils::SetCurrentThreadName(Name);
+        TRACE_THREAD_NAME(Name);
+
         // Invoke start callback if set
         {
             std::function<void()> cb;
@@ -219,6 +240,7 @@ private:
             T result;
             try
             {
+                TRACE_ZONE_CAT(Name, "processor");
                 result = Processor(std::move(item));
             }
             catch (...)
@@ -227,6 +249,12 @@ private:
                 continue;
             }
 
+            if (OnCompleted)
+            {
+                OnCompleted(std::move(result));
+                continue;
+            }
+
             // Put into completed queue
             {
                 std::lock_guard<std::mutex> lk(CompletedMutex);
@@ -265,6 +293,12 @@ private:
     std::function<void()> OnThreadStart;
     std::function<void()> OnThreadStop;
 
+    // Receives results instead of the completed queue when set
+    std::function<void(T&&)> OnCompleted;
+
+    // Thread and trace name
+    const char* Name = "ThreadedProcessor";
+
     // Guard for starting the worker once
     std::mutex StartMutex;
 };
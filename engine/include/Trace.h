@@ -0,0 +1,72 @@
+#pragma once
+// Trace.h
+// Timeline capture of tasks, stage waits and loader work, written as Chrome trace JSON
+// (open in chrome://tracing or ui.perfetto.dev).
+// - compiled out unless ENGINE_TRACING is defined (premake5 --tracing=on), the macros expand to nothing
+// - every thread records into its own fixed size event buffer, the record path takes no locks
+// - nothing is recorded until Capture() is called; once the requested frames have ended the file is
+//   written from the main thread
+// - zone and category names must be string literals (or otherwise outlive the capture)
+
+#include <cstdint>
+#include <string>
+
+namespace Trace
+{
+    int64_t Now();
+
+    // name shown for the calling thread's track
+    void SetThreadName(const char* name);
+
+    // record a finished zone for the calling thread, times from Now()
+    void RecordZone(const char* name, const char* category, int64_t start, int64_t end);
+
+    // start recording, the trace is written after frameCount more frames
+    void Capture(uint32_t frameCount, const std::string& path = "trace.json");
+
+    bool IsCapturing();
+
+    // called by TaskManager::TickFrame at the start and end of every frame
+    void BeginFrame();
+    void EndFrame();
+
+    struct ScopedZone
+    {
+        const char* Name;
+        const char* Category;
+        int64_t Start;
+
+        ScopedZone(const char* name, const char* category)
+            : Name(name)
+            , Category(category)
+            , Start(IsCapturing() ? Now() : 0)
+        {
+        }
+
+        ~ScopedZone()
+        {
+            if (Start != 0)
+                RecordZone(Name, Category, Start, Now());
+        }
+
+        ScopedZone(const ScopedZone&) = delete;
+        ScopedZone& operator=(const ScopedZone&) = delete;
+    };
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#if defined(ENGINE_TRACING)
+#define TRACE_ZONE_CAT(name, category) Trace::ScopedZone TRACE_CONCAT(traceZone, __LINE__)(name, category)
+#define TRACE_ZONE(name) TRACE_ZONE_CAT(name, "engine")
+#define TRACE_THREAD_NAME(name) Trace::SetThreadName(name)
+#define TRACE_BEGIN_FRAME() Trace::BeginFrame()
+#define TRACE_END_FRAME() Trace::EndFrame()
+#else
+#define TRACE_ZONE_CAT(name, category) ((void)0)
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#define TRACE_BEGIN_FRAME() ((void)0)
+#define TRACE_END_FRAME() ((void)0)
+#endif
@@ -0,0 +1,161 @@
+#pragma once
+// WorkStealingQueue.h
+// Lock-free Chase-Lev work stealing deque (Le, Pop, Cohen, Zappa Nardelli 2013 memory model).
+// - the owning thread pushes and pops at the bottom (LIFO, cache friendly)
+// - any other thread may steal from the top (FIFO)
+// - the ring buffer grows when full; retired buffers are kept alive until the queue is destroyed
+//   so a thief that loaded an old buffer pointer never reads freed memory
+// - T must be trivially copyable (intended for raw pointers)
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <type_traits>
+
+template<typename T>
+class WorkStealingQueue
+{
+    static_assert(std::is_trivially_copyable_v<T>, "WorkStealingQueue items must be trivially copyable");
+
+public:
+    explicit WorkStealingQueue(size_t capacity = 256)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+
+        Retired.push_back(std::make_unique<RingBuffer>(size));
+        Buffer.store(Retired.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+    // Owner only: push one item at the bottom
+    void Push(T item)
+    {
+        int64_t bottom = Bottom.load(std::memory_order_relaxed);
+        int64_t top = Top.load(std::memory_order_acquire);
+        RingBuffer* buffer = Buffer.load(std::memory_order_relaxed);
+
+        if (bottom - top > int64_t(buffer->Capacity()) - 1)
+            buffer = Grow(buffer, top, bottom);
+
+        buffer->Put(bottom, item);
+        Bottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    // Owner only: push a batch of items with a single publish
+    void PushBulk(std::span<T const> items)
+    {
+        if (items.empty())
+            return;
+
+        int64_t bottom = Bottom.load(std::memory_order_relaxed);
+        int64_t top = Top.load(std::memory_order_acquire);
+        RingBuffer* buffer = Buffer.load(std::memory_order_relaxed);
+
+        while (bottom - top + int64_t(items.size()) > int64_t(buffer->Capacity()))
+            buffer = Grow(buffer, top, bottom);
+
+        for (size_t i = 0; i < items.size(); i++)
+            buffer->Put(bottom + int64_t(i), items[i]);
+
+        Bottom.store(bottom + int64_t(items.size()), std::memory_order_release);
+    }
+
+    // Owner only: pop the most recently pushed item
+    bool Pop(T& out)
+    {
+        int64_t bottom = Bottom.load(std::memory_order_relaxed) - 1;
+        RingBuffer* buffer = Buffer.load(std::memory_order_relaxed);
+        Bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = Top.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            // empty
+            Bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        out = buffer->Get(bottom);
+        if (top == bottom)
+        {
+            // last item, race against thieves for it
+            bool won = Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            Bottom.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread: steal the oldest item
+    bool Steal(T& out)
+    {
+        int64_t top = Top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = Bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom)
+            return false;
+
+        RingBuffer* buffer = Buffer.load(std::memory_order_acquire);
+        T item = buffer->Get(top);
+        if (!Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false; // lost the race, caller can retry elsewhere
+
+        out = item;
+        return true;
+    }
+
+    // Approximate, may change immediately after the call
+    size_t Size() const
+    {
+        int64_t bottom = Bottom.load(std::memory_order_relaxed);
+        int64_t top = Top.load(std::memory_order_relaxed);
+        return bottom > top ? size_t(bottom - top) : 0;
+    }
+
+    bool Empty() const { return Size() == 0; }
+
+private:
+    struct RingBuffer
+    {
+        size_t Mask = 0;
+        std::unique_ptr<std::atomic<T>[]> Items;
+
+        explicit RingBuffer(size_t capacity)
+            : Mask(capacity - 1)
+            , Items(std::make_unique<std::atomic<T>[]>(capacity))
+        {
+        }
+
+        size_t Capacity() const { return Mask + 1; }
+
+        T Get(int64_t index) const { return Items[size_t(index) & Mask].load(std::memory_order_relaxed); }
+        void Put(int64_t index, T item) { Items[size_t(index) & Mask].store(item, std::memory_order_relaxed); }
+    };
+
+    RingBuffer* Grow(RingBuffer* buffer, int64_t top, int64_t bottom)
+    {
+        auto bigger = std::make_unique<RingBuffer>(buffer->Capacity() * 2);
+        for (int64_t i = top; i < bottom; i++)
+            bigger->Put(i, buffer->Get(i));
+
+        RingBuffer* result = bigger.get();
+        Retired.push_back(std::move(bigger));
+        Buffer.store(result, std::memory_order_release);
+        return result;
+    }
+
+    alignas(64) std::atomic<int64_t> Top{ 0 };
+    alignas(64) std::atomic<int64_t> Bottom{ 0 };
+    alignas(64) std::atomic<RingBuffer*> Buffer{ nullptr };
+
+    // owner only, every buffer ever allocated (the active one is last)
+    std::vector<std::unique_ptr<RingBuffer>> Retired;
+};
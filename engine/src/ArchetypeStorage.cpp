@@ -0,0 +1,464 @@
+#include "ArchetypeStorage.h"
+#include "SparseSet.h"
+
+#include "raylib.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+namespace ArchetypeStorage
+{
+    struct EntityLocation
+    {
+        Archetype* Type = nullptr;
+        size_t Row = 0;
+    };
+
+    struct RowRef
+    {
+        ArchetypeChunk* Chunk = nullptr;
+        size_t Index = 0;
+    };
+
+    std::shared_mutex StorageLock;
+
+    // walks whose func is running on this thread, some thread holds the storage lock shared for them
+    thread_local size_t WalkDepth = 0;
+
+    void EnterWalk()
+    {
+        WalkDepth++;
+    }
+
+    void LeaveWalk()
+    {
+        WalkDepth--;
+    }
+
+    // taking the lock shared again under a walk can block behind a waiting writer, the walk's lock already
+    // keeps writers out
+    static std::shared_lock<std::shared_mutex> LockShared()
+    {
+        if (WalkDepth > 0)
+            return std::shared_lock<std::shared_mutex>();
+
+        return std::shared_lock<std::shared_mutex>(StorageLock);
+    }
+
+    // a writer under a walk would wait on the walk that is waiting on it
+    static bool CanWrite(const char* operation)
+    {
+        if (WalkDepth == 0)
+            return true;
+
+        TraceLog(LOG_ERROR, "ArchetypeStorage: %s called from inside a chunk walk, post it to the main thread", operation);
+        return false;
+    }
+
+    // node based, the archetypes keep pointers to the infos
+    std::unordered_map<size_t, DataComponentInfo> ComponentInfos;
+
+    // keyed by the sorted component types
+    std::map<std::vector<size_t>, std::unique_ptr<Archetype>> Archetypes;
+
+    // entities with no data components have no location, dense in LocatedEntities order
+    SparseSet LocatedEntities;
+    std::vector<EntityLocation> EntityLocations;
+
+    static EntityLocation* FindLocation(size_t entityId)
+    {
+        uint32_t slot = LocatedEntities.Find(entityId);
+        return slot == SparseSet::Missing ? nullptr : &EntityLocations[slot];
+    }
+
+    static void SetLocation(size_t entityId, const EntityLocation& location)
+    {
+        if (EntityLocation* existing = FindLocation(entityId))
+        {
+            *existing = location;
+            return;
+        }
+
+        LocatedEntities.Insert(entityId);
+        EntityLocations.push_back(location);
+    }
+
+    static void EraseLocation(size_t entityId)
+    {
+        uint32_t slot = LocatedEntities.Erase(entityId);
+        if (slot == SparseSet::Missing)
+            return;
+
+        EntityLocations[slot] = EntityLocations.back();
+        EntityLocations.pop_back();
+    }
+
+    static size_t AlignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    static bool LayoutColumns(Archetype& archetype, size_t capacity)
+    {
+        archetype.ColumnOffsets.clear();
+
+        size_t offset = sizeof(size_t) * capacity;
+        for (const DataComponentInfo* info : archetype.Components)
+        {
+            offset = AlignUp(offset, ColumnAlignment);
+            archetype.ColumnOffsets.push_back(offset);
+            offset += info->Size * capacity;
+        }
+
+        return offset <= ChunkBytes;
+    }
+
+    static Archetype* GetArchetype(const std::vector<size_t>& componentTypes)
+    {
+        auto itr = Archetypes.find(componentTypes);
+        if (itr != Archetypes.end())
+            return itr->second.get();
+
+        auto archetype = std::make_unique<Archetype>();
+        archetype->ComponentTypes = componentTypes;
+
+        size_t rowBytes = sizeof(size_t);
+        for (size_t componentType : componentTypes)
+        {
+            const DataComponentInfo* info = &ComponentInfos.at(componentType);
+            archetype->Components.push_back(info);
+            rowBytes += info->Size;
+        }
+
+        // as many rows as fit once every column is padded out to its alignment
+        size_t capacity = ChunkBytes / rowBytes;
+        while (capacity > 1 && !LayoutColumns(*archetype, capacity))
+            capacity--;
+        archetype->ChunkCapacity = capacity;
+
+        Archetype* result = archetype.get();
+        Archetypes.emplace(componentTypes, std::move(archetype));
+        return result;
+    }
+
+    static Archetype* GetAddTarget(Archetype* source, size_t componentType)
+    {
+        if (source)
+        {
+            auto edge = source->AddEdges.find(componentType);
+            if (edge != source->AddEdges.end())
+                return edge->second;
+        }
+
+        std::vector<size_t> componentTypes;
+        if (source)
+            componentTypes = source->ComponentTypes;
+        componentTypes.insert(std::upper_bound(componentTypes.begin(), componentTypes.end(), componentType), componentType);
+
+        Archetype* target = GetArchetype(componentTypes);
+        if (source)
+        {
+            source->AddEdges[componentType] = target;
+            target->RemoveEdges[componentType] = source;
+        }
+        return target;
+    }
+
+    // nullptr when the source holds only that component type
+    static Archetype* GetRemoveTarget(Archetype* source, size_t componentType)
+    {
+        if (source->ComponentTypes.size() == 1)
+            return nullptr;
+
+        auto edge = source->RemoveEdges.find(componentType);
+        if (edge != source->RemoveEdges.end())
+            return edge->second;
+
+        std::vector<size_t> componentTypes = source->ComponentTypes;
+        std::erase(componentTypes, componentType);
+
+        Archetype* target = GetArchetype(componentTypes);
+        source->RemoveEdges[componentType] = target;
+        target->AddEdges[componentType] = source;
+        return target;
+    }
+
+    static RowRef GetRow(const Archetype& archetype, size_t row)
+    {
+        return RowRef{ archetype.Chunks[row / archetype.ChunkCapacity].get(), row % archetype.ChunkCapacity };
+    }
+
+    static std::byte* GetComponent(const Archetype& archetype, RowRef row, size_t column)
+    {
+        return archetype.GetColumn(*row.Chunk, column) + row.Index * archetype.Components[column]->Size;
+    }
+
+    static size_t AppendRow(Archetype& archetype, size_t entityId)
+    {
+        size_t row = archetype.EntityCount++;
+        if (row / archetype.ChunkCapacity >= archetype.Chunks.size())
+            archetype.Chunks.push_back(std::make_unique_for_overwrite<ArchetypeChunk>());
+
+        RowRef ref = GetRow(archetype, row);
+        archetype.GetEntities(*ref.Chunk)[ref.Index] = entityId;
+        return row;
+    }
+
+    static void EraseRow(Archetype& archetype, size_t row)
+    {
+        size_t last = --archetype.EntityCount;
+        if (row != last)
+        {
+            RowRef hole = GetRow(archetype, row);
+            RowRef tail = GetRow(archetype, last);
+
+            size_t movedEntity = archetype.GetEntities(*tail.Chunk)[tail.Index];
+            archetype.GetEntities(*hole.Chunk)[hole.Index] = movedEntity;
+            for (size_t column = 0; column < archetype.Components.size(); column++)
+                memcpy(GetComponent(archetype, hole, column), GetComponent(archetype, tail, column), archetype.Components[column]->Size);
+
+            FindLocation(movedEntity)->Row = row;
+        }
+
+        // one spare chunk is kept so an entity moving back and forth over a chunk boundary does not reallocate
+        size_t chunksInUse = (archetype.EntityCount + archetype.ChunkCapacity - 1) / archetype.ChunkCapacity;
+        if (archetype.Chunks.size() > chunksInUse + 1)
+            archetype.Chunks.pop_back();
+    }
+
+    // copies the components the archetypes share and constructs the rest, then releases the old row
+    static size_t MoveRow(size_t entityId, Archetype* source, size_t sourceRow, Archetype& target)
+    {
+        size_t row = AppendRow(target, entityId);
+        RowRef dest = GetRow(target, row);
+
+        for (size_t column = 0; column < target.Components.size(); column++)
+        {
+            const DataComponentInfo* info = target.Components[column];
+            std::byte* component = GetComponent(target, dest, column);
+
+            int sourceColumn = source ? source->FindColumn(info->ComponentType) : -1;
+            if (sourceColumn >= 0)
+                memcpy(component, GetComponent(*source, GetRow(*source, sourceRow), size_t(sourceColumn)), info->Size);
+            else
+                info->Construct(component);
+        }
+
+        if (source)
+            EraseRow(*source, sourceRow);
+
+        return row;
+    }
+
+    void RegisterComponent(const DataComponentInfo& info)
+    {
+        if (!CanWrite("RegisterComponent"))
+            return;
+
+        std::unique_lock<std::shared_mutex> lock(StorageLock);
+        if (ComponentInfos.contains(info.ComponentType))
+            return;
+
+        ComponentInfos.emplace(info.ComponentType, info);
+    }
+
+    bool IsDataComponent(size_t componentType)
+    {
+        auto lock = LockShared();
+        return ComponentInfos.contains(componentType);
+    }
+
+    void* Add(size_t entityId, size_t componentType)
+    {
+        if (!CanWrite("Add"))
+            return nullptr;
+
+        std::unique_lock<std::shared_mutex> lock(StorageLock);
+        if (!ComponentInfos.contains(componentType))
+            return nullptr;
+
+        Archetype* source = nullptr;
+        size_t sourceRow = 0;
+
+        if (const EntityLocation* location = FindLocation(entityId))
+        {
+            source = location->Type;
+            sourceRow = location->Row;
+
+            int column = source->FindColumn(componentType);
+            if (column >= 0)
+                return GetComponent(*source, GetRow(*source, sourceRow), size_t(column));
+        }
+
+        Archetype* target = GetAddTarget(source, componentType);
+        size_t row = MoveRow(entityId, source, sourceRow, *target);
+        SetLocation(entityId, EntityLocation{ target, row });
+
+        return GetComponent(*target, GetRow(*target, row), size_t(target->FindColumn(componentType)));
+    }
+
+    void Remove(size_t entityId, size_t componentType)
+    {
+        if (!CanWrite("Remove"))
+            return;
+
+        std::unique_lock<std::shared_mutex> lock(StorageLock);
+
+        const EntityLocation* location = FindLocation(entityId);
+        if (!location)
+            return;
+
+        Archetype* source = location->Type;
+        size_t sourceRow = location->Row;
+        if (source->FindColumn(componentType) < 0)
+            return;
+
+        Archetype* target = GetRemoveTarget(source, componentType);
+        if (!target)
+        {
+            EraseLocation(entityId);
+            EraseRow(*source, sourceRow);
+            return;
+        }
+
+        size_t row = MoveRow(entityId, source, sourceRow, *target);
+        SetLocation(entityId, EntityLocation{ target, row });
+    }
+
+    void* Get(size_t entityId, size_t componentType)
+    {
+        auto lock = LockShared();
+
+        const EntityLocation* location = FindLocation(entityId);
+        if (!location)
+            return nullptr;
+
+        const Archetype& archetype = *location->Type;
+        int column = archetype.FindColumn(componentType);
+        if (column < 0)
+            return nullptr;
+
+        return GetComponent(archetype, GetRow(archetype, location->Row), size_t(column));
+    }
+
+    bool Has(size_t entityId, size_t componentType)
+    {
+        auto lock = LockShared();
+
+        const EntityLocation* location = FindLocation(entityId);
+        return location && location->Type->FindColumn(componentType) >= 0;
+    }
+
+    void Resolve(size_t componentType, std::span<const size_t> entities, void** components)
+    {
+        auto lock = LockShared();
+
+        for (size_t i = 0; i < entities.size(); i++)
+        {
+            components[i] = nullptr;
+
+            const EntityLocation* location = FindLocation(entities[i]);
+            if (!location)
+                continue;
+
+            int column = location->Type->FindColumn(componentType);
+            if (column >= 0)
+                components[i] = GetComponent(*location->Type, GetRow(*location->Type, location->Row), size_t(column));
+        }
+    }
+
+    static bool HoldsAll(const Archetype& archetype, std::span<const size_t> componentTypes)
+    {
+        return std::all_of(componentTypes.begin(), componentTypes.end(), [&](size_t componentType)
+            {
+                return std::binary_search(archetype.ComponentTypes.begin(), archetype.ComponentTypes.end(), componentType);
+            });
+    }
+
+    size_t Count(std::span<const size_t> componentTypes)
+    {
+        auto lock = LockShared();
+
+        size_t count = 0;
+        for (auto& [types, archetype] : Archetypes)
+        {
+            if (HoldsAll(*archetype, componentTypes))
+                count += archetype->EntityCount;
+        }
+        return count;
+    }
+
+    bool Read(size_t componentType, void* component, BufferReader& buffer)
+    {
+        const DataComponentInfo* info = nullptr;
+        {
+            auto lock = LockShared();
+            auto itr = ComponentInfos.find(componentType);
+            if (itr == ComponentInfos.end() || !itr->second.Read)
+                return false;
+
+            info = &itr->second;
+        }
+
+        return info->Read(component, buffer);
+    }
+
+    void RemoveEntity(size_t entityId)
+    {
+        if (!CanWrite("RemoveEntity"))
+            return;
+
+        std::unique_lock<std::shared_mutex> lock(StorageLock);
+
+        const EntityLocation* location = FindLocation(entityId);
+        if (!location)
+            return;
+
+        Archetype* source = location->Type;
+        size_t sourceRow = location->Row;
+        EraseLocation(entityId);
+        EraseRow(*source, sourceRow);
+    }
+
+    void Clear()
+    {
+        if (!CanWrite("Clear"))
+            return;
+
+        std::unique_lock<std::shared_mutex> lock(StorageLock);
+
+        for (auto& [componentTypes, archetype] : Archetypes)
+        {
+            archetype->EntityCount = 0;
+            archetype->Chunks.clear();
+        }
+        LocatedEntities.Clear();
+        EntityLocations.clear();
+    }
+
+    size_t GetArchetypeCount()
+    {
+        auto lock = LockShared();
+        return Archetypes.size();
+    }
+
+    ChunkWalk::ChunkWalk(std::span<const size_t> componentTypes)
+        : Lock(LockShared())
+    {
+        for (auto& [types, archetype] : Archetypes)
+        {
+            if (archetype->EntityCount == 0)
+                continue;
+
+            if (!HoldsAll(*archetype, componentTypes))
+                continue;
+
+            for (size_t first = 0; first < archetype->EntityCount; first += archetype->ChunkCapacity)
+            {
+                Chunks.push_back(ChunkRef{ archetype.get(), archetype->Chunks[first / archetype->ChunkCapacity].get(),
+                    std::min(archetype->ChunkCapacity, archetype->EntityCount - first) });
+            }
+        }
+    }
+}
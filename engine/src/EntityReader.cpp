@@ -22,7 +22,7 @@ namespace EntityReader
             int64_t entityId = reader.Read<int64_t>();
 
             size_t realEnityId = static_cast<size_t>(entityId);
-            if (entityId <= 0 || EntitySystem::EntityExists(entityId))
+            if (entityId <= 0 || size_t(entityId) >= EntitySystem::MaxEntityId || EntitySystem::EntityExists(entityId))
                 realEnityId = EntitySystem::NewEntityId();
 
             uint32_t componentCount = reader.Read<uint32_t>();
@@ -36,6 +36,15 @@ namespace EntityReader
 
                 BufferReader componentData = reader.ReadBuffer(dataSize);
 
+                // data components have no base class, they read themselves
+                if (ArchetypeStorage::IsDataComponent(componentId))
+                {
+                    void* data = EntitySystem::AddDataComponent(realEnityId, componentId);
+                    if (data && !ArchetypeStorage::Read(componentId, data, componentData))
+                        TraceLog(LOG_WARNING, "Data component %zu on entity %zu has no OnDataRead", size_t(componentId), realEnityId);
+                    continue;
+                }
+
                 EntitySystem::EntityComponent* component = EntitySystem::AddComponent(realEnityId, componentId);
                 if (component)
                 {
@@ -1,10 +1,17 @@
 #include "EntitySystem.h"
+#include "EntityQuery.h"
+#include "TaskCounter.h"
 
+#include <array>
+#include <atomic>
+#include <bit>
 #include <memory>
+#include <numeric>
+#include <random>
 #include <unordered_map>
-#include <map>
 #include <set>
 #include <functional>
+#include <thread>
 
 namespace EntitySystem
 {
@@ -12,22 +19,132 @@ namespace EntitySystem
 
     std::set<size_t> EntityMorgue;
 
+    // removed entities are released a batch per main thread maintenance step, between frames
+    static constexpr size_t MorgueBatchSize = 64;
+    bool MorgueFlushQueued = false;
+
+    static bool FlushMorgueBatch();
+
     std::mutex TableLock;
     static std::unordered_map<size_t, std::unique_ptr<IComponentTable>> ComponentTables;
     size_t NextEntityId = 1;
 
+    // dense type index of each table, the bit it sets in an entity's component mask
+    static std::unordered_map<size_t, uint32_t> ComponentTypeIndices;
+    static std::array<IComponentTable*, MaxComponentTypes> ComponentTablesByIndex = {};
+
     std::mutex ReusableEntityIDsLock;
     std::vector<size_t> ReusableEntityIDs;
 
-    struct EntityInfo
+    // per entity metadata, bits and masks indexed by entity id. Pages are allocated on first use and never
+    // freed, so readers find them without a lock.
+    static constexpr size_t EntityPageBits = 12;
+    static constexpr size_t EntitiesPerPage = size_t(1) << EntityPageBits;
+    static constexpr size_t EntityPageCount = MaxEntityId / EntitiesPerPage;
+
+    struct EntityPage
     {
-        bool Awake = false;
-        bool Enabled = true;
-        std::set<size_t> ComponentTypes; // componentType -> index in table
+        std::array<std::atomic<uint64_t>, EntitiesPerPage / 64> Exists = {};
+        std::array<std::atomic<uint64_t>, EntitiesPerPage / 64> Awake = {};
+        std::array<std::atomic<uint64_t>, EntitiesPerPage / 64> Enabled = {};
+
+        // bit n is the table with type index n, data components keep theirs in the archetype
+        std::array<std::atomic<uint64_t>, EntitiesPerPage> ComponentMasks = {};
     };
 
-    std::recursive_mutex EntityInfoLock;
-    static std::map<size_t, EntityInfo> EntityInfoCache;
+    struct EntitySlot
+    {
+        EntityPage* Page = nullptr;
+        size_t Word = 0;
+        uint64_t Bit = 0;
+        size_t Index = 0;
+    };
+
+    std::mutex EntityPageLock;
+    static std::vector<std::unique_ptr<EntityPage>> EntityPageStorage;
+    static std::array<std::atomic<EntityPage*>, EntityPageCount> EntityPages = {};
+
+    static EntitySlot FindEntity(size_t entityId)
+    {
+        if (entityId >= MaxEntityId)
+            return EntitySlot();
+
+        size_t index = entityId & (EntitiesPerPage - 1);
+        return EntitySlot{ EntityPages[entityId >> EntityPageBits].load(std::memory_order_acquire), index / 64, uint64_t(1) << (index % 64), index };
+    }
+
+    static bool TestBit(const std::array<std::atomic<uint64_t>, EntitiesPerPage / 64>& words, const EntitySlot& slot)
+    {
+        return (words[slot.Word].load(std::memory_order_acquire) & slot.Bit) != 0;
+    }
+
+    static void SetBit(std::array<std::atomic<uint64_t>, EntitiesPerPage / 64>& words, const EntitySlot& slot, bool set)
+    {
+        if (set)
+            words[slot.Word].fetch_or(slot.Bit, std::memory_order_acq_rel);
+        else
+            words[slot.Word].fetch_and(~slot.Bit, std::memory_order_acq_rel);
+    }
+
+    static bool IsLive(const EntitySlot& slot)
+    {
+        return slot.Page && TestBit(slot.Page->Exists, slot);
+    }
+
+    // creates the entity's metadata the first time a component is added, enabled and not yet awake
+    static EntitySlot EnsureEntity(size_t entityId)
+    {
+        if (entityId >= MaxEntityId)
+        {
+            TraceLog(LOG_WARNING, "Entity %zu is past the entity id range", entityId);
+            return EntitySlot();
+        }
+
+        EntitySlot slot = FindEntity(entityId);
+        if (!slot.Page)
+        {
+            std::lock_guard<std::mutex> lock(EntityPageLock);
+            auto& page = EntityPages[entityId >> EntityPageBits];
+            if (!page.load(std::memory_order_relaxed))
+            {
+                EntityPageStorage.push_back(std::make_unique<EntityPage>());
+                page.store(EntityPageStorage.back().get(), std::memory_order_release);
+            }
+            slot = FindEntity(entityId);
+        }
+
+        if (!TestBit(slot.Page->Exists, slot))
+        {
+            slot.Page->ComponentMasks[slot.Index].store(0, std::memory_order_relaxed);
+            SetBit(slot.Page->Awake, slot, false);
+            SetBit(slot.Page->Enabled, slot, true);
+            SetBit(slot.Page->Exists, slot, true);
+        }
+        return slot;
+    }
+
+    // every live entity, in id order
+    template<class Func>
+    static void ForEachLiveEntity(Func&& func)
+    {
+        for (size_t page = 0; page < EntityPageCount; page++)
+        {
+            EntityPage* entities = EntityPages[page].load(std::memory_order_acquire);
+            if (!entities)
+                continue;
+
+            for (size_t word = 0; word < entities->Exists.size(); word++)
+            {
+                uint64_t bits = entities->Exists[word].load(std::memory_order_acquire);
+                while (bits)
+                {
+                    size_t bit = size_t(std::countr_zero(bits));
+                    bits &= bits - 1;
+                    func((page << EntityPageBits) + word * 64 + bit);
+                }
+            }
+        }
+    }
 
     void Init()
     {
@@ -66,7 +183,7 @@ namespace EntitySystem
     {
         IComponentTable* table = GetComponentTable(componentType);
         if (!table)
-            return false;
+            return ArchetypeStorage::Has(entityId, componentType);
 
         return table->HasEntity(entityId);
     }
@@ -74,6 +191,19 @@ namespace EntitySystem
     void RegisterComponent(size_t compnentType, std::unique_ptr<IComponentTable> table)
     {
         std::lock_guard<std::mutex> lock(TableLock);
+
+        auto index = ComponentTypeIndices.find(compnentType);
+        if (index == ComponentTypeIndices.end())
+        {
+            if (ComponentTypeIndices.size() >= MaxComponentTypes)
+            {
+                TraceLog(LOG_ERROR, "Component type %zu not registered, all %zu component type indices are in use", compnentType, MaxComponentTypes);
+                return;
+            }
+            index = ComponentTypeIndices.emplace(compnentType, uint32_t(ComponentTypeIndices.size())).first;
+        }
+
+        ComponentTablesByIndex[index->second] = table.get();
         ComponentTables.insert_or_assign(compnentType, std::move(table));
     }
 
@@ -88,32 +218,40 @@ namespace EntitySystem
 
     EntityComponent* AddComponent(size_t entityId, size_t componentType)
     {
-        {
-            if (!EntityInfoCache.contains(entityId))
-                EntityInfoCache.insert_or_assign(entityId, EntityInfo());
-        }
+        EntitySlot slot = EnsureEntity(entityId);
+        if (!slot.Page)
+            return nullptr;
 
         std::lock_guard<std::mutex> lock(TableLock);
         auto itr = ComponentTables.find(componentType);
         if (itr == ComponentTables.end())
             return nullptr;
-        EntityInfoCache[entityId].ComponentTypes.insert(componentType);
+
+        slot.Page->ComponentMasks[slot.Index].fetch_or(uint64_t(1) << ComponentTypeIndices[componentType], std::memory_order_acq_rel);
         return itr->second->Add(entityId);
     }
 
+    void* AddDataComponent(size_t entityId, size_t componentType)
+    {
+        if (!EnsureEntity(entityId).Page)
+            return nullptr;
+
+        return ArchetypeStorage::Add(entityId, componentType);
+    }
+
     bool EntityExists(size_t entityId)
     {
-        std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-        return EntityInfoCache.contains(entityId);
+        return IsLive(FindEntity(entityId));
     }
 
     void RemoveEntity(size_t entityId)
     {
+        // iteration stops seeing it now, its components are released with the morgue
+        EntitySlot slot = FindEntity(entityId);
+        if (IsLive(slot))
         {
-            std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-            auto itr = EntityInfoCache.find(entityId);
-            if (itr != EntityInfoCache.end())
-                EntityInfoCache.erase(itr);
+            SetBit(slot.Page->Exists, slot, false);
+            SetBit(slot.Page->Awake, slot, false);
         }
 
         {
@@ -121,42 +259,46 @@ namespace EntitySystem
             std::lock_guard<std::recursive_mutex> lock(MorgueLock);
             EntityMorgue.insert(entityId);
 
+            if (!MorgueFlushQueued)
+            {
+                MorgueFlushQueued = true;
+                TaskManager::AddMaintenanceJob("Flush Morgue", &FlushMorgueBatch, true);
+            }
+
         }
     }
 
     void AwakeAllEntities()
     {
-        std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-        for (auto& [entity, info] : EntityInfoCache)
-        {
-            info.Awake = true;
-            DoForeachComponentOfEntity(entity, [](EntityComponent& componnent) { componnent.OnAwake(); });
-        }
+        ForEachLiveEntity([](size_t entityId)
+            {
+                EntitySlot slot = FindEntity(entityId);
+                SetBit(slot.Page->Awake, slot, true);
+                DoForeachComponentOfEntity(entityId, [](EntityComponent& componnent) { componnent.OnAwake(); });
+            });
 
         TraceLog(LOG_INFO, "Awake All Entities");
     }
 
+    // removed entities are not awake, so neither test needs the exists bit
     bool IsEntityReady(size_t entityId)
     {
-        std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-        auto itr = EntityInfoCache.find(entityId);
-        return itr != EntityInfoCache.end() && itr->second.Awake;
+        EntitySlot slot = FindEntity(entityId);
+        return slot.Page && TestBit(slot.Page->Awake, slot);
     }
 
     bool IsEntityEnabled(size_t entityId)
     {
-        std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-        auto itr = EntityInfoCache.find(entityId);
-        return itr != EntityInfoCache.end() && itr->second.Awake && itr->second.Enabled;
+        EntitySlot slot = FindEntity(entityId);
+        return slot.Page && TestBit(slot.Page->Awake, slot) && TestBit(slot.Page->Enabled, slot);
     }
 
     void EnableEntity(size_t entityId, bool enabled)
     {
-        std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-        auto itr = EntityInfoCache.find(entityId);
-        if (itr != EntityInfoCache.end())
-            itr->second.Enabled = enabled;
- 
+        EntitySlot slot = FindEntity(entityId);
+        if (IsLive(slot))
+            SetBit(slot.Page->Enabled, slot, enabled);
+
         DoForeachComponentOfEntity(entityId, [enabled](EntityComponent& componnent)
             {
                 if (enabled)
@@ -168,12 +310,9 @@ namespace EntitySystem
 
     void AwakeEntity(size_t entityId)
     {
-        {
-            std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-            auto itr = EntityInfoCache.find(entityId);
-            if (itr != EntityInfoCache.end())
-                itr->second.Awake = true;
-        }
+        EntitySlot slot = FindEntity(entityId);
+        if (IsLive(slot))
+            SetBit(slot.Page->Awake, slot, true);
 
         DoForeachComponentOfEntity(entityId, [](EntityComponent& componnent)
         {
@@ -193,8 +332,46 @@ namespace EntitySystem
                 table->Clear();
             }
         }
-        std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-        EntityInfoCache.clear();
+        ArchetypeStorage::Clear();
+
+        for (auto& page : EntityPages)
+        {
+            EntityPage* entities = page.load(std::memory_order_acquire);
+            if (!entities)
+                continue;
+
+            for (size_t word = 0; word < entities->Exists.size(); word++)
+            {
+                entities->Exists[word].store(0, std::memory_order_release);
+                entities->Awake[word].store(0, std::memory_order_release);
+            }
+        }
+    }
+
+    static void ReleaseMorgueEntity(size_t entityId)
+    {
+        ReleaseEntityId(entityId);
+        ArchetypeStorage::RemoveEntity(entityId);
+
+        std::lock_guard<std::mutex> lock(TableLock);
+        for (auto& [componentType, table] : ComponentTables)
+        {
+            table->Remove(entityId);
+        }
+    }
+
+    static bool FlushMorgueBatch()
+    {
+        std::lock_guard<std::recursive_mutex> lock(MorgueLock);
+
+        for (size_t i = 0; i < MorgueBatchSize && !EntityMorgue.empty(); i++)
+        {
+            ReleaseMorgueEntity(*EntityMorgue.begin());
+            EntityMorgue.erase(EntityMorgue.begin());
+        }
+
+        MorgueFlushQueued = !EntityMorgue.empty();
+        return MorgueFlushQueued;
     }
 
     void FlushMorgue()
@@ -203,29 +380,46 @@ namespace EntitySystem
  
         for (size_t entityId : EntityMorgue)
         {
-            ReleaseEntityId(entityId);
-            {
-                std::lock_guard<std::mutex> lock(TableLock);
-                for (auto& [componentType, table] : ComponentTables)
-                {
-                    table->Remove(entityId);
-                }
-            }
+            ReleaseMorgueEntity(entityId);
         }
 
         EntityMorgue.clear();
     }
 
+    // a chunk walk, func may look up data components but not add or remove them
+    static void DoForEachEntityWithDataComponent(size_t componentType, std::function<void(size_t&)>& func, bool paralel, bool enabledOnly)
+    {
+        ArchetypeStorage::ChunkWalk walk(std::span<const size_t>(&componentType, 1));
+        walk.Run([&func, enabledOnly](const ArchetypeStorage::ChunkRef& chunk)
+            {
+                size_t* entities = chunk.GetEntities();
+                for (size_t i = 0; i < chunk.Count; i++)
+                {
+                    size_t entityId = entities[i];
+                    if (!enabledOnly || IsEntityEnabled(entityId))
+                        func(entityId);
+                }
+            }, paralel);
+    }
+
     void DoForEachEntityWithComponent(size_t componentType, std::function<void(size_t&)> func, bool paralel, bool enabledOnly)
     {
+        if (!func)
+            return;
+
         IComponentTable* table = nullptr;
         {
             std::lock_guard<std::mutex> lock(TableLock);
             auto itr = ComponentTables.find(componentType);
-            if (itr == ComponentTables.end() || !func)
-                return;
+            if (itr != ComponentTables.end())
+                table = itr->second.get();
+        }
 
-            table = itr->second.get();
+        if (!table)
+        {
+            if (ArchetypeStorage::IsDataComponent(componentType))
+                DoForEachEntityWithDataComponent(componentType, func, paralel, enabledOnly);
+            return;
         }
 
         table->DoForEach([&func](EntityComponent& component)
@@ -254,20 +448,214 @@ namespace EntitySystem
 
     void DoForeachComponentOfEntity(size_t entityId, std::function<void(EntityComponent&)> func)
     {
-        std::set<size_t>* components = nullptr;
-        {
-            std::lock_guard<std::recursive_mutex> lock(EntityInfoLock);
-            auto itr = EntityInfoCache.find(entityId);
-            if (itr == EntityInfoCache.end())
-                return;
+        EntitySlot slot = FindEntity(entityId);
+        if (!IsLive(slot))
+            return;
 
-            components = &itr->second.ComponentTypes;
-        }
-        for (auto componentType : *components)
+        uint64_t mask = slot.Page->ComponentMasks[slot.Index].load(std::memory_order_acquire);
+        while (mask)
         {
-            auto comp = GetComponentTable(componentType)->TryGet(entityId);
+            size_t typeIndex = size_t(std::countr_zero(mask));
+            mask &= mask - 1;
+
+            auto comp = ComponentTablesByIndex[typeIndex]->TryGet(entityId);
             if (comp)
                 func(*comp);
         }
     }
 }
+
+namespace UnitTest
+{
+    using namespace EntitySystem;
+
+    template<class Func>
+    static double TimePerItem(size_t count, Func&& func)
+    {
+        int64_t start = TaskCounter::Now();
+        func();
+        return double(TaskCounter::Now() - start) / double(count);
+    }
+
+    // ComponentTable's entity -> component index, the sparse set against the hash map it replaced. Ids are
+    // allocated like NewEntityId and looked up in random order, as a system reading another entity's component would.
+    int ComponentIndexBenchmark()
+    {
+        std::mt19937_64 random(42);
+
+        for (size_t count : { 10000, 100000, 1000000 })
+        {
+            std::vector<size_t> ids(count);
+            std::iota(ids.begin(), ids.end(), 1);
+
+            std::vector<size_t> lookups = ids;
+            std::shuffle(lookups.begin(), lookups.end(), random);
+
+            std::unordered_map<size_t, size_t> map;
+            SparseSet set;
+            size_t mapSum = 0;
+            size_t setSum = 0;
+
+            double mapInsert = TimePerItem(count, [&]()
+                {
+                    for (size_t i = 0; i < count; i++)
+                        map[ids[i]] = i;
+                });
+            double setInsert = TimePerItem(count, [&]()
+                {
+                    for (size_t id : ids)
+                        set.Insert(id);
+                });
+
+            double mapFind = TimePerItem(count, [&]()
+                {
+                    for (size_t id : lookups)
+                    {
+                        auto itr = map.find(id);
+                        if (itr != map.end())
+                            mapSum += itr->second;
+                    }
+                });
+            double setFind = TimePerItem(count, [&]()
+                {
+                    for (size_t id : lookups)
+                    {
+                        uint32_t index = set.Find(id);
+                        if (index != SparseSet::Missing)
+                            setSum += index;
+                    }
+                });
+
+            // every other entity, in random order
+            double mapErase = TimePerItem(count / 2, [&]()
+                {
+                    for (size_t i = 0; i < count; i += 2)
+                        map.erase(lookups[i]);
+                });
+            double setErase = TimePerItem(count / 2, [&]()
+                {
+                    for (size_t i = 0; i < count; i += 2)
+                        set.Erase(lookups[i]);
+                });
+
+            if (mapSum != setSum || map.size() != set.Size())
+                TraceLog(LOG_WARNING, "Component index: map and sparse set disagree");
+
+            TraceLog(LOG_INFO, "Component index: %zu entities, find %.1f ns map %.1f ns sparse, insert %.1f / %.1f ns, erase %.1f / %.1f ns",
+                count, mapFind, setFind, mapInsert, setInsert, mapErase, setErase);
+        }
+
+        return 0;
+    }
+
+    struct QueryTestComponent : public EntityComponent
+    {
+        DECLARE_SIMPLE_COMPONENT(QueryTestComponent);
+        size_t Owner = 0;
+    };
+
+    struct QueryTestData
+    {
+        DECLARE_DATA_COMPONENT(QueryTestData);
+        size_t Owner = 0;
+    };
+
+    // ParallelEach while pool tasks add the driven component type. The join must not run those tasks under the
+    // driver's lock: a table would grow under the other workers' batches, archetype storage would deadlock.
+    int QueryStructuralChangeTest()
+    {
+        static constexpr size_t Entities = 4096;
+        static constexpr size_t Spawners = 32;
+        static constexpr size_t SpawnsPerTask = 16;
+
+        RegisterComponent<QueryTestComponent>();
+        RegisterComponent<QueryTestData>();
+
+        std::vector<size_t> spawned;
+        std::mutex spawnedLock;
+        std::atomic<size_t> pending = 0;
+
+        auto spawn = [&]()
+            {
+                for (size_t i = 0; i < SpawnsPerTask; i++)
+                {
+                    size_t entityId = NewEntityId();
+                    AddComponent<QueryTestComponent>(entityId)->Owner = entityId;
+                    AddComponent<QueryTestData>(entityId)->Owner = entityId;
+                    AwakeEntity(entityId);
+
+                    std::lock_guard<std::mutex> lock(spawnedLock);
+                    spawned.push_back(entityId);
+                }
+            };
+
+        for (size_t i = 0; i < Entities / SpawnsPerTask; i++)
+            spawn();
+
+        int failures = 0;
+        for (int driver = 0; driver < 2; driver++)
+        {
+            pending.store(Spawners);
+            std::atomic<bool> posted = false;
+            auto post = [&]()
+                {
+                    if (posted.exchange(true))
+                        return;
+
+                    for (size_t i = 0; i < Spawners; i++)
+                    {
+                        TaskManager::Post(TaskLane::FrameNormal, [&]()
+                            {
+                                spawn();
+                                pending.fetch_sub(1);
+                            }, "Query Test Spawn");
+                    }
+                };
+
+            // queued from inside the first batch so they are waiting while the query joins, without a pool Post
+            // runs them inline and that must stay outside the query
+            if (TaskManager::GetWorkerCount() == 0)
+                post();
+
+            std::atomic<size_t> visited = 0;
+            std::atomic<size_t> mismatched = 0;
+            if (driver == 0)
+            {
+                Query<QueryTestComponent>().ParallelEach([&](QueryTestComponent& component)
+                    {
+                        post();
+                        if (component.Owner != component.EntityID)
+                            mismatched++;
+                        visited++;
+                    });
+            }
+            else
+            {
+                Query<QueryTestData>().ParallelEach([&](QueryTestData&)
+                    {
+                        post();
+                        visited++;
+                    });
+            }
+
+            while (pending.load() > 0)
+                std::this_thread::yield();
+
+            // the spawns may land before, during or after the walk
+            size_t before = Entities + size_t(driver) * Spawners * SpawnsPerTask;
+            size_t after = before + Spawners * SpawnsPerTask;
+            if (mismatched.load() > 0 || visited.load() < before || visited.load() > after)
+            {
+                TraceLog(LOG_WARNING, "Query structural change: visited %zu of %zu to %zu, %zu mismatched", visited.load(), before, after, mismatched.load());
+                failures++;
+            }
+        }
+
+        for (size_t entityId : spawned)
+            RemoveEntity(entityId);
+        FlushMorgue();
+
+        TraceLog(LOG_INFO, "Query structural change: %s", failures == 0 ? "passed" : "failed");
+        return failures;
+    }
+}
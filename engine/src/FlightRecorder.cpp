@@ -0,0 +1,188 @@
+#include "FlightRecorder.h"
+#include "TaskManager.h"
+#include "TaskCounter.h"
+
+#include "raylib.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace FlightRecorder
+{
+    struct DumpJob
+    {
+        std::string Path;
+        std::string Reason;
+        std::vector<FrameRecord> Frames;
+
+        // copied on the main thread, custom stages may be defined while the dump is written
+        std::vector<std::pair<FrameStage, const char*>> Stages;
+        bool Written = false;
+    };
+    using DumpJobRef = std::shared_ptr<DumpJob>;
+
+    // main thread only
+    std::unique_ptr<std::array<FrameRecord, FrameCount>> Ring;
+    uint64_t NextFrameIndex = 0;
+    int64_t FrameStartTime = 0;
+    int64_t LastFrameEndTime = 0;
+
+    float SpikeThreshold = 0;
+    uint64_t LastDumpFrame = 0;
+    bool HasDumped = false;
+    uint32_t DumpCount = 0;
+    std::string DumpPrefix = "flight";
+
+    // dumps are written on the pool's background I/O lane and reported back through the main thread inbox
+    TaskCounter DumpsInFlight;
+
+    void FrameRecord::AddTask(const char* name, size_t taskId, float duration)
+    {
+        if (TaskCount >= MaxTasksPerFrame)
+            return;
+
+        Tasks[TaskCount++] = TaskSample{ name, taskId, duration };
+    }
+
+    static float ToSeconds(int64_t nanoseconds)
+    {
+        return float(double(nanoseconds) / 1e9);
+    }
+
+    static void WriteDump(DumpJob& job)
+    {
+        std::ofstream stages(job.Path + "_stages.csv");
+        std::ofstream tasks(job.Path + "_tasks.csv");
+        if (!stages || !tasks)
+            return;
+
+        stages << "# " << job.Reason << "\n";
+        stages << "frame,frame_ms,tick_ms";
+        for (auto [stage, name] : job.Stages)
+        {
+            stages << "," << name << "_ms," << name << "_blocked_ms," << name << "_tasks," << name << "_skipped," << name << "_deferred";
+        }
+        stages << "\n";
+
+        tasks << "frame,task,task_id,ms\n";
+
+        for (const FrameRecord& frame : job.Frames)
+        {
+            stages << frame.FrameIndex << "," << frame.FrameTime * 1000.0f << "," << frame.TickTime * 1000.0f;
+            for (auto [stage, name] : job.Stages)
+            {
+                const StageSample& sample = frame.Stages[size_t(stage)];
+                stages << "," << sample.Duration * 1000.0f << "," << sample.Blocked * 1000.0f << "," << sample.TaskCount << "," << sample.Skipped << "," << sample.Deferred;
+            }
+            stages << "\n";
+
+            for (uint32_t i = 0; i < frame.TaskCount; i++)
+            {
+                const TaskSample& task = frame.Tasks[i];
+                tasks << frame.FrameIndex << "," << (task.Name ? task.Name : "Task") << "," << task.TaskId << "," << task.Duration * 1000.0f << "\n";
+            }
+        }
+
+        job.Written = true;
+    }
+
+    static void ReportDump(const DumpJob& job)
+    {
+        if (job.Written)
+            TraceLog(LOG_INFO, "Flight recorder wrote %zu frames to %s (%s)", job.Frames.size(), job.Path.c_str(), job.Reason.c_str());
+        else
+            TraceLog(LOG_WARNING, "Flight recorder could not write %s", job.Path.c_str());
+    }
+
+    FrameRecord& BeginFrame()
+    {
+        if (!Ring)
+            Ring = std::make_unique<std::array<FrameRecord, FrameCount>>();
+
+        FrameStartTime = TaskCounter::Now();
+
+        FrameRecord& record = (*Ring)[NextFrameIndex % FrameCount];
+        record.FrameIndex = NextFrameIndex;
+        record.FrameTime = 0;
+        record.TickTime = 0;
+        record.Stages.fill(StageSample{});
+        record.TaskCount = 0;
+        return record;
+    }
+
+    void EndFrame()
+    {
+        int64_t now = TaskCounter::Now();
+
+        FrameRecord& record = (*Ring)[NextFrameIndex % FrameCount];
+        record.TickTime = ToSeconds(now - FrameStartTime);
+        record.FrameTime = LastFrameEndTime != 0 ? ToSeconds(now - LastFrameEndTime) : record.TickTime;
+        LastFrameEndTime = now;
+        NextFrameIndex++;
+
+        // one dump per window, the frames after a spike are usually slow too
+        bool windowRolled = !HasDumped || NextFrameIndex - LastDumpFrame >= FrameCount;
+        if (SpikeThreshold > 0 && record.FrameTime > SpikeThreshold && windowRolled)
+            Dump(TextFormat("frame %llu took %0.3f ms", (unsigned long long)record.FrameIndex, record.FrameTime * 1000.0f));
+    }
+
+    void SetSpikeThreshold(float seconds)
+    {
+        SpikeThreshold = seconds;
+    }
+
+    float GetSpikeThreshold()
+    {
+        return SpikeThreshold;
+    }
+
+    void SetDumpPrefix(const std::string& prefix)
+    {
+        DumpPrefix = prefix;
+    }
+
+    void Dump(const char* reason)
+    {
+        if (!Ring || NextFrameIndex == 0)
+            return;
+
+        auto job = std::make_shared<DumpJob>();
+        job->Reason = reason;
+        job->Path = DumpPrefix + "_" + std::to_string(DumpCount++);
+
+        for (FrameStage stage : TaskManager::GetStageOrder())
+            job->Stages.emplace_back(stage, GetStageName(stage));
+
+        // oldest first
+        size_t frames = size_t(std::min<uint64_t>(NextFrameIndex, FrameCount));
+        job->Frames.reserve(frames);
+        for (size_t i = frames; i > 0; i--)
+            job->Frames.push_back(*GetFrame(i - 1));
+
+        DumpsInFlight.Add();
+        TaskManager::Post(TaskLane::BackgroundIO, [job]()
+            {
+                WriteDump(*job);
+                TaskManager::PostToMainThread(FrameStage::FrameHead, [job]() { ReportDump(*job); });
+                DumpsInFlight.Release();
+            }, "Flight Recorder Dump");
+
+        LastDumpFrame = NextFrameIndex;
+        HasDumped = true;
+    }
+
+    const FrameRecord* GetFrame(size_t framesAgo)
+    {
+        if (!Ring || framesAgo >= FrameCount || framesAgo >= NextFrameIndex)
+            return nullptr;
+
+        return &(*Ring)[(NextFrameIndex - 1 - framesAgo) % FrameCount];
+    }
+
+    void Shutdown()
+    {
+        DumpsInFlight.Wait();
+    }
+}
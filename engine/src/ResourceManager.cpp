@@ -1,5 +1,8 @@
 #include "ResourceManager.h"
+#include "TaskManager.h"
+#include "Trace.h"
 
+#include <algorithm>
 #include <fstream>
 #include <atomic>
 #include <sstream>
@@ -18,18 +21,33 @@ namespace ResourceManager
         ResourceType Type = ResourceType::File;
         std::string Path;
         ResourceInfoRef Info; // pointer back to ResourceInfo so main thread can attach results
-        ResourceData Data;    // filled by loader thread
+        std::vector<unsigned char> Bytes; // file contents, read on the I/O lane
+        ResourceData Data;    // filled by the decode lane
     };
+    using PendingLoadRef = std::shared_ptr<PendingLoad>;
 
-    // 4 loader threads
-    static constexpr int LoaderThreadCount = 4;
-    static std::vector<std::unique_ptr<ThreadedProcessor<PendingLoad>>> Loaders;
-    static std::atomic<size_t> RoundRobinIndex{ 0 };
+    // loads run as two jobs on the TaskManager pool, the file read on the background I/O lane and the
+    // decode on the background decode lane, so they never compete with frame work for a core
+    static std::atomic<bool> Running{ false };
+    static TaskCounter LoadsInFlight;
+    static MainThreadDispatcher Dispatcher;
+
+    // finished loads waiting for Update() when there is no dispatcher
+    static std::mutex CompletedMutex;
+    static std::vector<PendingLoadRef> Completed;
 
     // Map of active resources
     static std::unordered_map<size_t, ResourceInfoRef>  Resources;
     static std::recursive_mutex                         ResourcesMutex;
 
+    // released resources waiting for their data to be freed by a pool maintenance job
+    static constexpr size_t EvictionBatchSize = 8;
+    static std::mutex                                   EvictedMutex;
+    static std::vector<ResourceInfoRef>                 Evicted;
+    static bool                                         EvictionQueued = false;
+
+    static bool EvictBatch();
+
     // Helper: compute resource file path from id + type (adjust as needed)
     static std::string BuildPath(size_t id, ResourceType type)
     {
@@ -59,33 +77,38 @@ namespace ResourceManager
         return out;
     }
 
-    // Loader function executed inside loader threads
-    static PendingLoad LoaderFunction(PendingLoad pending)
+    // Decode the bytes read by ReadLoad into the resource data, executed on the decode lane
+    static void DecodeLoad(PendingLoad& pending)
     {
-        // Attempt to load based on type. Any failures leave Data as monostate.
+        // Any failures leave Data as monostate.
         try
         {
             switch (pending.Type)
             {
             case ResourceType::Image:
             {
-                // Load image (CPU memory)
-                Image img = LoadImage(pending.Path.c_str());
+                if (pending.Bytes.empty())
+                    break;
+
+                // Decode image (CPU memory)
+                Image img = LoadImageFromMemory(".png", pending.Bytes.data(), int(pending.Bytes.size()));
                 pending.Data = std::move(img);
                 break;
             }
             case ResourceType::Music:
             {
-                Wave w = LoadWave(pending.Path.c_str());
+                if (pending.Bytes.empty())
+                    break;
+
+                Wave w = LoadWaveFromMemory(".wav", pending.Bytes.data(), int(pending.Bytes.size()));
                 pending.Data = std::move(w);
                 break;
             }
             case ResourceType::File:
             default:
             {
-                // Use std::ifstream to read raw bytes
-                auto bytes = ReadFileToVector(pending.Path);
-                pending.Data = std::move(bytes);
+                // raw files need no decoding
+                pending.Data = std::move(pending.Bytes);
                 break;
             }
             }
@@ -94,15 +117,48 @@ namespace ResourceManager
         {
             // swallow exceptions; leave pending.Data empty (monostate)
         }
-        return pending;
+        pending.Bytes = std::vector<unsigned char>{};
     }
 
-    // Unload resource data (must be called from main thread if raylib unloading functions used)
-    static void UnloadResourceData(ResourceInfoRef& info)
+    static void FinishLoad(PendingLoad& completed);
+
+    // hand a decoded load to the main thread
+    static void CompleteLoad(PendingLoadRef pending)
     {
-        std::lock_guard<std::mutex> lk(info->Lock);
-        if (!info->Ready) return;
+        if (Dispatcher)
+        {
+            Dispatcher([pending]() { FinishLoad(*pending); });
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lk(CompletedMutex);
+            Completed.push_back(std::move(pending));
+        }
+        LoadsInFlight.Release();
+    }
+
+    // Read the file, executed on the I/O lane, then queue the decode
+    static void ReadLoad(PendingLoadRef pending)
+    {
+        try
+        {
+            pending->Bytes = ReadFileToVector(pending->Path);
+        }
+        catch (...)
+        {
+            // swallow exceptions; the decode sees no bytes
+        }
+
+        TaskManager::Post(TaskLane::BackgroundDecode, [pending]()
+            {
+                DecodeLoad(*pending);
+                CompleteLoad(pending);
+            }, "Resource Decode");
+    }
 
+    // Free loaded data (must be called from main thread if raylib unloading functions used)
+    static void UnloadData(ResourceData& data)
+    {
         std::visit([&](auto&& value)
             {
                 using V = std::decay_t<decltype(value)>;
@@ -123,38 +179,73 @@ namespace ResourceManager
                 {
                     // monostate -> nothing
                 }
-            }, info->Data);
+            }, data);
 
-        info->Data = ResourceData{}; // reset
-        info->Ready.store(false, std::memory_order_release);
+        data = ResourceData{}; // reset
     }
 
+    // Unload resource data (must be called from main thread if raylib unloading functions used)
+    static void UnloadResourceData(ResourceInfoRef& info)
+    {
+        std::lock_guard<std::mutex> lk(info->Lock);
+        if (!info->Ready) return;
 
-    // Public API
+        UnloadData(info->Data);
+        info->Ready.store(false, std::memory_order_release);
+    }
 
-    void Init()
+
+    // Attach a finished load to its ResourceInfo and invoke callbacks (main thread)
+    static void FinishLoad(PendingLoad& completed)
     {
-        std::lock_guard<std::recursive_mutex> lk(ResourcesMutex);
-        if (!Loaders.empty()) return; // already initialized
+        ResourceInfoRef info = completed.Info;
+        if (!info) return;
+
+        // dispatched after Shutdown, nobody owns the resource anymore
+        if (!Running.load())
+        {
+            UnloadData(completed.Data);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(info->Lock);
+            // Move loaded data into ResourceInfo
+            info->Data = std::move(completed.Data);
+            info->Ready.store(true, std::memory_order_release);
+        }
+
+        // Invoke callbacks outside lock
+        std::vector<OnLoadedCb> callbacks;
+        {
+            std::lock_guard<std::mutex> lk(info->Lock);
+            callbacks.swap(info->Callbacks); // move callbacks out
+        }
 
-        Loaders.resize(LoaderThreadCount);
-        for (int i = 0; i < LoaderThreadCount; ++i)
+        TRACE_ZONE_CAT("Resource Callbacks", "resource");
+        for (auto& cb : callbacks)
         {
-            Loaders[i] = std::make_unique<ThreadedProcessor<PendingLoad>>();
-            Loaders[i]->SetProcessorAndStart(&LoaderFunction);
+            if (cb) cb(info);
         }
     }
 
+    // Public API
+
+    void Init()
+    {
+        Running.store(true);
+    }
+
     void Shutdown()
     {
-        // Stop loaders
-        for (auto& loader : Loaders)
-        {
-            if (loader) loader->Stop();
-        }
+        // Wait for loads still on the pool
+        LoadsInFlight.Wait();
 
         // Drain completed items so we can properly free memory
         Update();
+        Running.store(false);
+
+        while (EvictBatch()) {}
 
         // Unload and clear resources
         std::lock_guard<std::recursive_mutex> lk(ResourcesMutex);
@@ -167,41 +258,27 @@ namespace ResourceManager
             }
         }
         Resources.clear();
+    }
 
-        Loaders.clear();
+    void SetMainThreadDispatcher(MainThreadDispatcher dispatcher)
+    {
+        Dispatcher = std::move(dispatcher);
     }
 
     void Update()
     {
-        // Poll completed queues from all loaders
-        for (auto& loader : Loaders)
-        {
-            if (!loader) continue;
-            PendingLoad completed;
-            while (loader->PopCompleted(completed))
-            {
-                ResourceInfoRef info = completed.Info;
-                if (!info) continue;
-
-                {
-                    std::lock_guard<std::mutex> lk(info->Lock);
-                    // Move loaded data into ResourceInfo
-                    info->Data = std::move(completed.Data);
-                    info->Ready.store(true, std::memory_order_release);
-                }
+        TRACE_ZONE_CAT("ResourceManager::Update", "resource");
 
-                // Invoke callbacks outside lock
-                std::vector<OnLoadedCb> callbacks;
-                {
-                    std::lock_guard<std::mutex> lk(info->Lock);
-                    callbacks.swap(info->Callbacks); // move callbacks out
-                }
+        // Swap out the completed loads, callbacks may start new ones
+        std::vector<PendingLoadRef> completed;
+        {
+            std::lock_guard<std::mutex> lk(CompletedMutex);
+            completed.swap(Completed);
+        }
 
-                for (auto& cb : callbacks)
-                {
-                    if (cb) cb(info);
-                }
-            }
+        for (auto& pending : completed)
+        {
+            FinishLoad(*pending);
         }
     }
 
@@ -257,20 +334,41 @@ namespace ResourceManager
         }
 
    
-        // Build pending load and assign to a loader using round-robin
-        PendingLoad pending;
-        pending.ID = hash;
-        pending.Type = type;
-        pending.Path = BuildPath(hash, type);
-        pending.Info = info;
+        // Build pending load and queue its file read on the pool
+        auto pending = std::make_shared<PendingLoad>();
+        pending->ID = hash;
+        pending->Type = type;
+        pending->Path = BuildPath(hash, type);
+        pending->Info = info;
 
-        size_t idx = RoundRobinIndex.fetch_add(1, std::memory_order_relaxed);
-        idx %= Loaders.size();
-        Loaders[idx]->PushPending(std::move(pending));
+        LoadsInFlight.Add();
+        TaskManager::Post(TaskLane::BackgroundIO, [pending]() { ReadLoad(pending); }, "Resource Read");
 
         return info;
     }
 
+    ResourceAwaiter LoadResourceAsync(size_t hash, ResourceType type)
+    {
+        return ResourceAwaiter{ hash, type };
+    }
+
+    bool ResourceAwaiter::await_ready()
+    {
+        Info = LoadResource(Hash, Type);
+        return Info->IsReady();
+    }
+
+    bool ResourceAwaiter::await_suspend(std::coroutine_handle<> handle)
+    {
+        // the load may have finished since await_ready, Ready is set under the same lock
+        std::lock_guard<std::mutex> lk(Info->Lock);
+        if (Info->IsReady())
+            return false;
+
+        Info->Callbacks.push_back([handle](const ResourceInfoRef&) { handle.resume(); });
+        return true;
+    }
+
     void ReleaseResourceById(size_t id)
     {
         ResourceInfoRef info;
@@ -280,12 +378,37 @@ namespace ResourceManager
             if (it == Resources.end()) 
                 return;
             info = it->second;
+            Resources.erase(it);
+        }
 
-            // Unload memory on main thread
-            UnloadResourceData(info);
+        // Unloading is housekeeping, it happens off the frame's critical path
+        std::lock_guard<std::mutex> lk(EvictedMutex);
+        Evicted.push_back(std::move(info));
+        if (!EvictionQueued)
+        {
+            EvictionQueued = true;
+            TaskManager::AddMaintenanceJob("Resource Eviction", &EvictBatch);
+        }
+    }
 
-            Resources.erase(it);
+    static bool EvictBatch()
+    {
+        std::vector<ResourceInfoRef> batch;
+        {
+            std::lock_guard<std::mutex> lk(EvictedMutex);
+            size_t count = std::min(EvictionBatchSize, Evicted.size());
+            batch.assign(std::make_move_iterator(Evicted.end() - count), std::make_move_iterator(Evicted.end()));
+            Evicted.resize(Evicted.size() - count);
+        }
+
+        for (auto& info : batch)
+        {
+            UnloadResourceData(info);
         }
+
+        std::lock_guard<std::mutex> lk(EvictedMutex);
+        EvictionQueued = !Evicted.empty();
+        return EvictionQueued;
     }
 
     // ResourceInfo::Release implementation
@@ -1,6 +1,7 @@
 #include "SpriteManager.h"
 #include "ResourceManager.h"
 #include "BufferReader.h"
+#include "Coroutine.h"
 
 #include <unordered_map>
 
@@ -40,33 +41,44 @@ namespace SpriteManager
         return InstanceFromSpite(SpriteRef);
     }
 
+    static Coroutine LoadSprite(size_t hash, SpriteReference sprite)
+    {
+        auto data = co_await ResourceManager::LoadResourceAsync(hash);
+
+        auto bytes = std::get_if<std::vector<unsigned char>>(&data->Data);
+        if (!bytes)
+        {
+            TraceLog(LOG_ERROR, "Sprite %zu failed to load", hash);
+            co_return;
+        }
+
+        // TODO, parse sprite data
+        BufferReader reader(*bytes);
+
+        reader.Read<uint32_t>();
+        reader.Read<uint32_t>();
+
+        size_t textureHash = reader.Read<size_t>();
+
+        sprite->Texture = TextureManager::GetTexture(textureHash);
+        uint32_t frameCount = reader.Read<uint32_t>();
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            Rectangle frameRect = { reader.Read<float>(), reader.Read<float>(), reader.Read<float>(), reader.Read<float>() };
+            sprite->Frames[i] = frameRect;
+        }
+        sprite->Ready.store(true);
+    }
+
     SpriteInstance LoadResoruce(size_t hash)
     {
         if(Sprites.contains(hash))
             return InstanceFromSpite(Sprites[hash]);
 
         SpriteReference sprite = std::make_shared<Sprite>();
-        ResourceManager::LoadResource(hash, ResourceManager::ResourceType::File, [sprite](const ResourceManager::ResourceInfoRef& data)
-            {
-                // TODO, parse sprite data
-                BufferReader reader(std::get<std::vector<unsigned char>>(data->Data));
-
-                reader.Read<uint32_t>();
-                reader.Read<uint32_t>();
-
-                size_t textureHash = reader.Read<size_t>();
-
-                sprite->Texture = TextureManager::GetTexture(textureHash);
-                uint32_t frameCount = reader.Read<uint32_t>();
-                for (uint32_t i = 0; i < frameCount; i++)
-                {
-                    Rectangle frameRect = { reader.Read<float>(), reader.Read<float>(), reader.Read<float>(), reader.Read<float>() };
-                    sprite->Frames[i] = frameRect;
-                }
-                sprite->Ready.store(true);
-            });
-
         Sprites.insert({ hash, sprite });
+
+        TaskManager::StartCoroutine(LoadSprite(hash, sprite));
         return InstanceFromSpite(sprite);
     }
 
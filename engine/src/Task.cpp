@@ -1,15 +1,91 @@
 #include "Task.h"
+#include "TaskManager.h"
+#include "Trace.h"
+
+#include <algorithm>
 
 void Task::Execute()
 {
-    TickedThisFrame.store(true);
+    TRACE_ZONE_CAT(GetTaskName(), "task");
+
+    int64_t startTime = TaskCounter::Now();
+
+    // the first run in a frame starts the frame's execute time over
+    uint64_t frame = TaskManager::GetFrameIndex();
+    if (LastTickedFrame.load(std::memory_order_relaxed) != frame)
+    {
+        ExecuteTime.store(0, std::memory_order_relaxed);
+        LastTickedFrame.store(frame, std::memory_order_relaxed);
+    }
     Completed.store(false);
-    Tick();
+
+    // main thread tasks with predecessors are dispatched by their stage, wait for the edges here
+    if (!PendingPredecessors.IsDone())
+        TaskManager::WaitForCounter(PendingPredecessors);
+
+    for (uint32_t step = 0; step < StepRepeats; step++)
+    {
+        RunDependencies(DependencyTiming::BeforeParent);
+        Tick();
+        RunDependencies(DependencyTiming::AfterParent);
+    }
+
+    int64_t finishTime = TaskCounter::Now();
+    ExecuteTime.fetch_add(finishTime - startTime, std::memory_order_relaxed);
+    FinishTime.store(finishTime, std::memory_order_relaxed);
+    Completed.store(true);
+
+    // only a scheduled run releases successors, not a one shot or a dependency run of the same task
+    if (!Successors.empty() && CompletionCounter == StageCounter)
+        TaskManager::ReleaseSuccessors(this);
+
+    TaskCounter* stepCounter = StepCounter;
+    if (CompletionCounter)
+        CompletionCounter->Release();
+    if (stepCounter)
+        stepCounter->Release();
+}
+
+void Task::RunDependencies(DependencyTiming timing)
+{
+    if (Dependencies.empty())
+        return;
+
+    // fork every worker child but the last one, that one runs here instead of idling in the join
+    Task* keep = nullptr;
     for (auto& dependency : Dependencies)
     {
+        if (dependency->Timing != timing || dependency->RunInMainThread)
+            continue;
+
+        dependency->CompletionCounter = &DependencyCounter;
+        DependencyCounter.Add();
+
+        if (keep)
+            TaskManager::SubmitTask(keep);
+        keep = dependency.get();
+    }
+
+    // RunInMainThread children run inline on the parent's thread, a worker when the parent is a worker task, as
+    // they did before forking. Sending them to the main thread inbox would stall this join until a stage boundary
+    for (auto& dependency : Dependencies)
+    {
+        if (dependency->Timing != timing || !dependency->RunInMainThread)
+            continue;
+
+        dependency->CompletionCounter = nullptr;
         dependency->Execute();
     }
-    Completed.store(true);
+
+    if (keep)
+        keep->Execute();
+
+    TaskManager::WaitForCounter(DependencyCounter);
+}
+
+bool Task::WasTickedThisFrame() const
+{
+    return LastTickedFrame.load(std::memory_order_relaxed) == TaskManager::GetFrameIndex();
 }
 
 bool Task::IsComplete()
@@ -17,6 +93,31 @@ bool Task::IsComplete()
     return Completed.load();
 }
 
+void Task::SetBlocksStage(FrameStage stage)
+{
+    BlocksStage = stage;
+    TaskManager::InvalidateSchedule();
+}
+
+void Task::After(Task* predecessor)
+{
+    if (!predecessor || predecessor == this || std::find(Predecessors.begin(), Predecessors.end(), predecessor) != Predecessors.end())
+        return;
+
+    Predecessors.push_back(predecessor);
+    TaskManager::InvalidateSchedule();
+}
+
+void Task::RemovePredecessor(Task* predecessor)
+{
+    auto it = std::find(Predecessors.begin(), Predecessors.end(), predecessor);
+    if (it == Predecessors.end())
+        return;
+
+    Predecessors.erase(it);
+    TaskManager::InvalidateSchedule();
+}
+
 FrameStage Task::GetBlocksStage()
 {
     if (BlocksStage != FrameStage::AutoNextState)
@@ -1,16 +1,39 @@
 #include "TaskManager.h"
 #include "TimeUtils.h"
+#include "Trace.h"
+#include "FlightRecorder.h"
+#include "ThreadUtils.h"
 
 #include "raylib.h"
 
 #include <unordered_map>
+#include <array>
+#include <deque>
+#include <random>
+#include <string>
 
-ThreadInfo::ThreadInfo() : Running(true)
+thread_local ThreadInfo* CurrentWorker = nullptr;
+
+
+namespace TaskManager
+{
+    Task* FindWork(ThreadInfo* self, bool background = false);
+    void FinishFoundTask(Task* task, TaskLane lane, bool owned);
+    bool HasPendingWork();
+    void WaitForWork(ThreadInfo* self);
+    void WakeWorkers(size_t count);
+    static void DrainInbox(FrameStage stage);
+    static void ReleaseTask(Task* task);
+    static void RunFoundTask(Task* task);
+    static void DrainMaintenance();
+    static void UpdateIdleMode();
+    static void ApplyTaskRequests();
+    static void ReclaimRetiredTasks();
+    uint64_t GetReclaimEpoch();
+}
+
+ThreadInfo::ThreadInfo(size_t threadId) : ThreadId(threadId)
 {
-    Thread = std::thread([this]()
-        {
-            Run();
-        });
 }
 
 ThreadInfo::~ThreadInfo()
@@ -18,49 +41,65 @@ ThreadInfo::~ThreadInfo()
     AbortTasks();
 }
 
+void ThreadInfo::Start()
+{
+    Running.store(true);
+    Thread = std::thread([this]()
+        {
+            Run();
+        });
+}
+
 void ThreadInfo::Run()
 {
-    while (true)
-    {
-        std::unique_lock<std::mutex> lock(Lock);
-        Trigger.wait(lock, [this]() { return !Running || !Tasks.empty(); });
-        if (!Running && Tasks.empty())
-            break;
+    CurrentWorker = this;
+
+    ThreadUtils::SetCurrentThreadName(Name.c_str());
+    TRACE_THREAD_NAME(Name.c_str());
 
-        if (Abort.load())
+    if (PinnedCore >= 0)
+        ThreadUtils::PinCurrentThread(size_t(PinnedCore));
+
+    while (Running.load())
+    {
+        // pinned before looking so a removed task found now isn't freed under it, quiescent while idle
+        PinnedEpoch.store(TaskManager::GetReclaimEpoch(), std::memory_order_seq_cst);
+        Task* task = TaskManager::FindWork(this, true);
+        if (!task)
         {
-            Tasks.clear();
-            break;
+            PinnedEpoch.store(UINT64_MAX, std::memory_order_seq_cst);
+            TaskManager::WaitForWork(this);
+            continue;
         }
 
+        TaskLane lane = task->Lane;
+        bool owned = task->OwnedByPool;
+
         IsProcessing.store(true);
-        Task* task = nullptr;
-        {
-            std::lock_guard<std::mutex> taskLock(TaskLock);
-      
-            task = Tasks.front();
-            Tasks.pop_front();
-        }
-       
         task->Execute();
-       
+
         if (OnTaskComplete)
             OnTaskComplete(task);
 
+        TaskManager::FinishFoundTask(task, lane, owned);
         IsProcessing.store(false);
     }
+
+    if (Abort.load())
+    {
+        Task* dropped = nullptr;
+        while (Tasks.Pop(dropped)) {}
+    }
+
     if (OnThreadAbort)
         OnThreadAbort(ThreadId);
 }
 
 void ThreadInfo::AbortTasks()
 {
-    {
-        std::lock_guard<std::mutex> lock(Lock);
-        Running.store(false);
-        Abort.store(true);
-    }
-    Trigger.notify_one();
+    Running.store(false);
+    Abort.store(true);
+    TaskManager::WakeWorkers(SIZE_MAX);
 
     if (Thread.joinable())
         Thread.join();
@@ -68,17 +107,12 @@ void ThreadInfo::AbortTasks()
 
 bool ThreadInfo::IsIdle()
 {
-    std::lock_guard<std::mutex> lock(TaskLock);
-    return Tasks.empty() && !IsProcessing.load();
+    return Tasks.Empty() && !IsProcessing.load();
 }
 
-void ThreadInfo::AddTask(Task* task)
+bool ThreadInfo::IsRunning()
 {
-    {
-        std::lock_guard<std::mutex> lock(TaskLock);
-        Tasks.push_back(task);
-    }
-    Trigger.notify_one();
+    return Running.load();
 }
 
 namespace TaskManager
@@ -86,221 +120,2425 @@ namespace TaskManager
     std::vector<std::unique_ptr<Task>> Tasks;
     std::vector<std::unique_ptr<ThreadInfo>> Threads;
 
-    // caches by stage
-    std::unordered_map<FrameStage, std::vector<Task*>> TasksPerStartStage;
-    std::unordered_map<FrameStage, std::vector<Task*>> TasksBlockingStages;
+    // The registered tasks flattened by starting stage, rebuilt only when tasks are added or removed.
+    // The blocker counts are summed per blocked stage so a dispatch adds to each counter once.
+    struct StageSchedule
+    {
+        std::vector<Task*> WorkerTasks;
+        std::vector<Task*> MainThreadTasks;
+        std::vector<std::pair<FrameStage, uint32_t>> WorkerBlocks;
+        std::vector<std::pair<FrameStage, uint32_t>> MainThreadBlocks;
+
+        // successors of fixed update tasks, released once the stage the fixed tasks block starts
+        std::vector<Task*> Releases;
+
+        // the worker tasks left after shedding, rebuilt only while the stage is over budget
+        std::vector<Task*> Kept;
+    };
+
+    std::array<StageSchedule, 256> Schedule;
+
+    // tasks with predecessors, armed at the start of every frame, and the stages the ones dispatched
+    // by their predecessors block
+    std::vector<Task*> ArmedTasks;
+    std::vector<std::pair<FrameStage, uint32_t>> EdgeBlocks;
+
+    // every registered task with its id, for the end of frame bookkeeping
+    std::vector<std::pair<Task*, size_t>> AllScheduledTasks;
+    std::atomic<bool> ScheduleDirty = true;
+
+    // adds and removals queued from any thread, a lock-free stack the main thread takes whole at the frame boundary
+    struct TaskRequest
+    {
+        std::unique_ptr<Task> Added = nullptr;
+        Task* Removed = nullptr;
+        size_t RemovedId = 0;
+        bool RemoveById = false;
+        TaskRequest* Next = nullptr;
+    };
+    std::atomic<TaskRequest*> PendingTaskRequests = nullptr;
+
+    // removed tasks with the epoch they were retired in, freed once every worker pinned a later one
+    std::atomic<uint64_t> ReclaimEpoch = 1;
+    std::vector<std::pair<uint64_t, std::unique_ptr<Task>>> RetiredTasks;
+
+    // the schedule only changes between frames, read by workers checking the frame budget
+    std::atomic<bool> InFrame = false;
+
+    // outstanding tasks that block each stage, indexed by stage value
+    std::array<TaskCounter, 256> StageBlockers;
 
 #if defined(DEBUG)
-    std::unordered_map<FrameStage, FrameStageStats> StageStats;
+    // fixed storage, the pipelined simulation writes stats from a worker while the main thread renders
+    std::array<FrameStageStats, 256> StageStats;
    
     FrameStageStats& GetStatsForStage(FrameStage stage)
     {
-        if (!StageStats.contains(stage))
-            StageStats[stage] = FrameStageStats();
-
-        return StageStats[stage];
+        return StageStats[size_t(stage)];
     }
 #endif 
 
-    size_t NextThreadIndex = 0;
+    // deque owned by the main thread, stage task lists are bulk submitted here and stolen by workers
+    WorkStealingQueue<Task*> MainQueue;
+    std::thread::id MainThreadId;
 
-    float FixedUpdateTime = 1.0f / FixedFPS;
-    float Accumulator = FixedUpdateTime;
+    // submissions from threads outside the pool (loader callbacks etc)
+    std::mutex InjectLock;
+    std::deque<Task*> InjectedTasks;
+    std::atomic<size_t> InjectedCount = 0;
 
-    void Init()
+    // shared queues for the lanes below FrameCritical, that one lives on the deques above
+    struct LaneQueue
     {
-        for (size_t i = 0; i < std::thread::hardware_concurrency(); i++)
-        {
-            auto threadInfo = std::make_unique<ThreadInfo>();
-            threadInfo->ThreadId = i;
-            Threads.push_back(std::move(threadInfo));
-        }
+        std::mutex Lock;
+        std::deque<Task*> Tasks;
+        std::atomic<size_t> Count = 0;
+    };
+    std::array<LaneQueue, TaskLaneCount> Lanes;
+
+    // background and idle lane tasks running now, capped while a frame is in flight
+    std::atomic<size_t> BackgroundRunning = 0;
+    std::atomic<bool> BackgroundOpen = true;
+
+    // parking for idle workers
+    std::mutex WakeLock;
+    std::condition_variable WakeSignal;
+    std::atomic<uint64_t> WorkEpoch = 0;
+    std::atomic<size_t> SleepingWorkers = 0;
+
+    // idle policy, copied into atomics since the workers read it while the main thread may change it
+    std::atomic<WorkerIdleMode> IdleMode = WorkerIdleMode::SpinThenPark;
+    std::atomic<int64_t> IdleSpinNanoseconds = 50000;
+    std::atomic<uint32_t> IdleYieldCount = 4;
+    std::atomic<float> IdleSlackThreshold = 0.5f;
+
+    // set at the end of each frame in Adaptive mode
+    std::atomic<bool> ParkEagerly = false;
+
+    // housekeeping waiting for its next step, for the pool's idle lane and for the end of the frame
+    struct MaintenanceJob
+    {
+        const char* Name = nullptr;
+        std::function<bool()> Step;
+    };
+
+    std::mutex MaintenanceLock;
+    std::deque<MaintenanceJob> PoolMaintenance;
+    std::deque<MaintenanceJob> MainThreadMaintenance;
+    std::atomic<bool> PoolMaintenancePosted = false;
+    std::atomic<int64_t> MaintenanceBudget = 1000000;
+    std::atomic<int64_t> MaintenanceTargetFrameTime = 16666667;
+
+    // this frame's start and the time the main thread spent waiting on the swap, the slack maintenance may use
+    std::atomic<int64_t> FrameBeginTime = 0;
+    int64_t SwapWaitTime = 0;
+
+    // seconds, 0 is no budget
+    std::array<std::atomic<float>, 256> StageBudgets = {};
+    std::atomic<float> FrameBudget = 0;
+
+    // tasks shed this frame by stage, counted from whichever thread dispatches them
+    std::array<std::atomic<uint32_t>, 256> SkippedTasks = {};
+    std::array<std::atomic<uint32_t>, 256> DeferredTasks = {};
+
+    // seconds the main thread may spend running pool tasks each time it waits for a stage
+    std::atomic<float> MainThreadHelpSlice = 0.002f;
+
+    // The stages in the order a frame runs them, custom ones are spliced in by DefineStage. Only changed between
+    // frames with nothing running, so the pool reads these without locking.
+    static constexpr uint8_t NotInFrame = 0xFF;
+    std::vector<FrameStage> StageOrder = { FrameStage::FrameHead, FrameStage::PreUpdate, FrameStage::FixedUpdate, FrameStage::Update,
+        FrameStage::PostUpdate, FrameStage::PreDraw, FrameStage::Draw, FrameStage::Present, FrameStage::PostDraw, FrameStage::FrameTail };
+
+    static std::array<uint8_t, 256> GetStagePositions(const std::vector<FrameStage>& order)
+    {
+        std::array<uint8_t, 256> positions;
+        positions.fill(NotInFrame);
+        for (size_t position = 0; position < order.size(); position++)
+            positions[size_t(order[position])] = uint8_t(position);
+        return positions;
     }
+    std::array<uint8_t, 256> StagePositions = GetStagePositions(StageOrder);
 
-    void Shutdown()
+    std::array<const char*, MaxCustomStages> CustomStageNames = {};
+
+    // the stage each one blocks by default, PreUpdate and FixedUpdate tasks may overlap the stage after them
+    static std::array<FrameStage, StageSlotCount> GetBuiltInBlocks()
     {
-        for (auto& thread : Threads)
+        std::array<FrameStage, StageSlotCount> blocks;
+        blocks.fill(FrameStage::None);
+        blocks[size_t(FrameStage::FrameHead)] = FrameStage::PreUpdate;
+        blocks[size_t(FrameStage::PreUpdate)] = FrameStage::Update;
+        blocks[size_t(FrameStage::FixedUpdate)] = FrameStage::PostUpdate;
+        blocks[size_t(FrameStage::Update)] = FrameStage::PostUpdate;
+        blocks[size_t(FrameStage::PostUpdate)] = FrameStage::PreDraw;
+        blocks[size_t(FrameStage::PreDraw)] = FrameStage::Draw;
+        blocks[size_t(FrameStage::Draw)] = FrameStage::Present;
+        blocks[size_t(FrameStage::Present)] = FrameStage::PostDraw;
+        blocks[size_t(FrameStage::PostDraw)] = FrameStage::FrameTail;
+        blocks[size_t(FrameStage::FrameTail)] = FrameStage::FrameHead;
+        return blocks;
+    }
+    std::array<FrameStage, StageSlotCount> StageBlocks = GetBuiltInBlocks();
+
+    // one accumulator per fixed-rate stage, a StepTime of 0 is a stage that runs once per frame
+    // the step count and alpha stay valid until the stage's next pass, its tasks read them while running
+    struct FixedLoop
+    {
+        std::atomic<float> StepTime = 0;
+        float Accumulator = 0;
+        std::atomic<uint32_t> StepsThisPass = 1;
+        std::atomic<float> Alpha = 0;
+
+        // the worker tasks dispatched by the current step, the next step waits on these and nothing else
+        TaskCounter StepTasks = {};
+    };
+
+    // FixedUpdate steps at FixedFPS until SetFixedRate changes it, the first frame has a step due
+    static_assert(size_t(FrameStage::FixedUpdate) == 3);
+    std::array<FixedLoop, StageSlotCount> FixedLoops = { FixedLoop{}, FixedLoop{}, FixedLoop{}, FixedLoop{ 1.0f / FixedFPS, 1.0f / FixedFPS } };
+
+    FixedStepPolicy StepPolicy;
+
+    // pipelined frames, simulation stages of this frame overlap the render stages
+    std::atomic<bool> PipelinedFrames = false;
+    bool PipelineActive = false;
+    std::vector<Task*> DeferredMainThreadTasks;
+
+    ThreadTopology Topology;
+
+    // closures posted to the main thread, by the stage that runs them
+    std::mutex InboxLock;
+    std::array<std::vector<std::function<void()>>, 256> Inbox;
+    std::array<std::vector<std::coroutine_handle<>>, 256> StageResumes;
+    std::vector<std::pair<uint64_t, std::coroutine_handle<>>> FrameResumes;
+    std::atomic<uint32_t> InboxCount = 0;
+
+    std::atomic<uint64_t> FrameIndex = 0;
+
+    // critical path ordering, the smoothed durations of removed tasks by TaskId and the per stage predictions
+    static constexpr float DurationSmoothing = 0.1f;
+    std::unordered_map<size_t, float> DurationHistory;
+
+    // written by the main thread at the end of a frame while the frame tail's workers may still read them
+    std::array<std::atomic<float>, 256> PredictedMakespan = {};
+    std::array<int64_t, 256> StageDispatchTime = {};
+
+    // this frame's flight recorder slot, stages add to it from whichever thread runs them
+    // stages run outside of TickFrame land in the scratch record
+    FlightRecorder::FrameRecord ScratchRecord;
+    FlightRecorder::FrameRecord* CurrentRecord = &ScratchRecord;
+    std::vector<std::function<void()>> FrameSyncCallbacks;
+
+    static void RunStage(FrameStage stage);
+
+    static size_t GetStagePosition(FrameStage stage)
+    {
+        return StagePositions[size_t(stage)];
+    }
+
+    // None's loop never steps, ids past the custom range read it
+    static FixedLoop& GetFixedLoop(FrameStage stage)
+    {
+        return FixedLoops[size_t(stage) < StageSlotCount ? size_t(stage) : 0];
+    }
+
+    static bool RunsBefore(FrameStage stage, FrameStage other)
+    {
+        return GetStagePosition(stage) < GetStagePosition(other);
+    }
+
+    static std::span<const FrameStage> GetSimulationStages()
+    {
+        size_t first = GetStagePosition(FirstSimulationStage);
+        return std::span<const FrameStage>(StageOrder).subspan(first, GetStagePosition(FirstRenderStage) - first);
+    }
+
+    static bool IsSimulationStage(FrameStage stage)
+    {
+        size_t position = GetStagePosition(stage);
+        return position >= GetStagePosition(FirstSimulationStage) && position < GetStagePosition(FirstRenderStage);
+    }
+
+    // the stages after FrameHead that finish before the render stages
+    static bool CanStep(FrameStage stage)
+    {
+        size_t position = GetStagePosition(stage);
+        return position > GetStagePosition(FrameStage::FrameHead) && position < GetStagePosition(FirstRenderStage);
+    }
+
+    class PipelinedSimulationTask : public Task
+    {
+    public:
+        DECLARE_TASK(PipelinedSimulationTask);
+
+    protected:
+        void Tick() override
         {
-            thread->AbortTasks();
+            for (FrameStage stage : GetSimulationStages())
+                RunStage(stage);
         }
-        Threads.clear();
-        Tasks.clear();
+    };
+
+    PipelinedSimulationTask PipelinedSimulation;
+    TaskCounter SimulationCounter;
+
+    static bool IsPipelinedStage(FrameStage stage)
+    {
+        return PipelineActive && IsSimulationStage(stage);
     }
 
-    void TickFrame()
+    void Init(const ThreadTopology& topology)
     {
-        for (auto& task : Tasks)
-            task->TickedThisFrame.store(false);
+        Topology = topology;
+
+        MainThreadId = std::this_thread::get_id();
+        ThreadUtils::SetCurrentThreadName("Main");
+        TRACE_THREAD_NAME("Main");
 
-        for (auto& [stage, blockerList] : TasksBlockingStages)
-            blockerList.clear();
+        size_t hardwareThreads = ThreadUtils::GetHardwareThreadCount();
+        size_t reserved = std::min(Topology.ReservedCores, hardwareThreads - 1);
 
-        Accumulator += GetDeltaTime();
+        size_t threadCount = Topology.WorkerCount;
+        if (threadCount == 0)
+            threadCount = std::max<size_t>(1, hardwareThreads - reserved);
 
-        for (FrameStage stage = FrameStage::FrameHead; stage <= FrameStage::FrameTail; ++stage)
+        if (Topology.PinThreads && reserved > 0)
         {
-#if defined(DEBUG)
-            auto& stats = GetStatsForStage(stage);
-            stats.TickedThisFrame = false;
-#endif
-            if (stage == FrameStage::FixedUpdate)
-            {
-                while (Accumulator >= FixedUpdateTime)
-                {
-                    RunTasksForStage(FrameStage::FixedUpdate);
-                    Accumulator -= FixedUpdateTime;
-                }
-            }
-            else
-            {
-                RunTasksForStage(stage);
-                if (stage == FrameStage::Present)
-                    EndDrawing();
-            }
+            ThreadUtils::SetReservedCores(0, reserved);
+            ThreadUtils::PinCurrentThreadToReservedCores();
+        }
+
+        for (size_t i = 0; i < threadCount; i++)
+        {
+            auto thread = std::make_unique<ThreadInfo>(i);
+            thread->Name = Topology.WorkerNamePrefix + " " + std::to_string(i);
+            if (Topology.PinThreads)
+                thread->PinnedCore = int((reserved + i) % hardwareThreads);
+
+            Threads.push_back(std::move(thread));
         }
+
+        // start only once the list is complete, workers steal from each other right away
+        for (auto& thread : Threads)
+            thread->Start();
     }
 
-    bool IsStageBlocked(FrameStage stage)
+    void Shutdown()
     {
-        if (!TasksBlockingStages.contains(stage))
-            return false;
+        // dumps are written on the pool
+        FlightRecorder::Shutdown();
+
+        for (auto& thread : Threads)
+        {
+            thread->AbortTasks();
+        }
+        Threads.clear();
+
+        // nothing can be running a task now, adds still queued are dropped with the registered and retired tasks
+        for (TaskRequest* request = PendingTaskRequests.exchange(nullptr); request;)
+        {
+            TaskRequest* next = request->Next;
+            delete request;
+            request = next;
+        }
+        Tasks.clear();
+        RetiredTasks.clear();
+        ScheduleDirty = true;
 
-        for (auto& task : TasksBlockingStages[stage])
+        // lane tasks that never ran, the pool's own jobs are freed
+        for (LaneQueue& lane : Lanes)
         {
-            if (!task->IsComplete())
+            std::lock_guard<std::mutex> lock(lane.Lock);
+            for (Task* task : lane.Tasks)
             {
-                return true;
+                if (task->OwnedByPool)
+                    delete task;
             }
+            lane.Tasks.clear();
+            lane.Count.store(0);
         }
-        return false;
+
+        // run whatever is still posted, the closures may own data that needs releasing
+        for (size_t stage = 0; stage < StageSlotCount; stage++)
+            DrainInbox(FrameStage(stage));
+
+        // maintenance runs to completion on this thread for the same reason
+        DrainMaintenance();
     }
 
-    void AdvanceThreadIndex()
+    const ThreadTopology& GetTopology()
     {
-        NextThreadIndex++;
-        if (NextThreadIndex >= Threads.size())
-            NextThreadIndex = 0;
+        return Topology;
     }
 
-    size_t GetAvailableThread()
+    static FrameStage GetInboxStage(FrameStage stage)
     {
-        for (size_t i = 0; i < Threads.size(); i++)
-        {
-            if (Threads[i]->IsIdle())
-                return i;
-        }
+        // posts for a custom stage wait for it to be defined, the positions may be changing under other threads
+        if (stage == FrameStage::None || size_t(stage) >= StageSlotCount)
+            return FrameStage::FrameHead;
+        return stage;
+    }
 
-        // just pick one
-        AdvanceThreadIndex();
-        return NextThreadIndex;
+    void PostToMainThread(FrameStage stage, std::function<void()> callback)
+    {
+        std::lock_guard<std::mutex> lock(InboxLock);
+        Inbox[size_t(GetInboxStage(stage))].push_back(std::move(callback));
+        InboxCount.fetch_add(1, std::memory_order_release);
     }
 
-    void RunTasksForStage(FrameStage stage)
+    void ResumeAtStage(FrameStage stage, std::coroutine_handle<> handle)
     {
-#if defined(DEBUG)
-        auto& stats = GetStatsForStage(stage);
-        stats.TaskCount = 0;
-        stats.BlockedDurration = 0;
-        stats.Durration = 0;
-        stats.StartTime = GetTime();
-        stats.TickedThisFrame = true;
-#endif
-        bool wasBlocked = false;
-        while (IsStageBlocked(stage))
+        std::lock_guard<std::mutex> lock(InboxLock);
+        StageResumes[size_t(GetInboxStage(stage))].push_back(handle);
+        InboxCount.fetch_add(1, std::memory_order_release);
+    }
+
+    void ResumeAfterFrames(uint32_t frameCount, std::coroutine_handle<> handle)
+    {
+        std::lock_guard<std::mutex> lock(InboxLock);
+        FrameResumes.emplace_back(FrameIndex.load() + frameCount, handle);
+    }
+
+    uint64_t GetFrameIndex()
+    {
+        return FrameIndex.load();
+    }
+
+    static void DrainInbox(FrameStage stage)
+    {
+        if (InboxCount.load(std::memory_order_acquire) == 0)
+            return;
+
+        // swap out so closures can post again, those run next time the stage comes around
+        std::vector<std::function<void()>> callbacks;
+        std::vector<std::coroutine_handle<>> resumes;
         {
-            wasBlocked = true;
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            std::lock_guard<std::mutex> lock(InboxLock);
+            callbacks.swap(Inbox[size_t(stage)]);
+            resumes.swap(StageResumes[size_t(stage)]);
+            InboxCount.fetch_sub(uint32_t(callbacks.size() + resumes.size()), std::memory_order_relaxed);
         }
 
-        if (wasBlocked)
+        for (auto& callback : callbacks)
+            callback();
+
+        for (auto handle : resumes)
+            handle.resume();
+    }
+
+    static void ResumeFrameWaiters()
+    {
+        std::vector<std::coroutine_handle<>> resumes;
         {
-#if defined(DEBUG)
-            stats.BlockedDurration = GetTime() - stats.StartTime;
+            std::lock_guard<std::mutex> lock(InboxLock);
+            if (FrameResumes.empty())
+                return;
 
-            if (stats.BlockedDurration > stats.MaxBlockedDurration)
-                stats.MaxBlockedDurration = stats.BlockedDurration;
-#endif
+            auto due = std::partition(FrameResumes.begin(), FrameResumes.end(), [](const auto& entry) { return entry.first > FrameIndex.load(); });
+            for (auto it = due; it != FrameResumes.end(); ++it)
+                resumes.push_back(it->second);
+            FrameResumes.erase(due, FrameResumes.end());
         }
 
-        if (TasksPerStartStage.contains(stage))
-        {
-            for (auto task : TasksPerStartStage[stage])
-            {
-                // save off the blocking stage
-                TasksBlockingStages[task->GetBlocksStage()].push_back(task);
+        for (auto handle : resumes)
+            handle.resume();
+    }
+
+    static void RunFixedLoop(FrameStage stage)
+    {
+        FixedLoop& loop = FixedLoops[size_t(stage)];
+        float stepTime = loop.StepTime.load(std::memory_order_relaxed);
 
-                if (task->RunInMainThread)
-                    continue;
+        uint32_t steps = uint32_t(loop.Accumulator / stepTime);
+        double droppedTime = 0;
 
-                Threads[GetAvailableThread()]->AddTask(task);
-#if defined(DEBUG)
-                stats.TaskCount++;
-#endif
-            }
+        uint32_t maxSteps = std::max(StepPolicy.MaxStepsPerFrame, 1u);
+        if (steps > maxSteps)
+        {
+            droppedTime = double(steps - maxSteps) * stepTime;
+            loop.Accumulator -= float(droppedTime);
+            steps = maxSteps;
+        }
 
-            for (auto task : TasksPerStartStage[stage])
+        loop.StepsThisPass.store(1);
+
+        if (StepPolicy.BatchCatchUp && steps > 1)
+        {
+            loop.StepsThisPass.store(steps);
+            RunTasksForStage(stage);
+            loop.Accumulator -= stepTime * steps;
+        }
+        else
+        {
+            for (uint32_t step = 0; step < steps; step++)
             {
-                if (!task->RunInMainThread)
-                    continue;
+                // the previous step's tasks must be done before they are dispatched again. Only those, the blocked
+                // stage's counter also holds tasks of later stages that can't run before this loop is done
+                if (step > 0)
+                    WaitForCounter(loop.StepTasks);
 
-                task->Execute();
-#if defined(DEBUG)
-                stats.TaskCount++;
-#endif
+                RunTasksForStage(stage);
+                loop.Accumulator -= stepTime;
             }
         }
 
+        loop.Alpha.store(std::clamp(loop.Accumulator / stepTime, 0.0f, 1.0f), std::memory_order_relaxed);
+
 #if defined(DEBUG)
-        stats.EndTime = GetTime();
-        stats.Durration = stats.EndTime - stats.StartTime;
-        if (stats.Durration > stats.MaxDurration)
-            stats.MaxDurration = stats.Durration;
+        auto& stats = GetStatsForStage(stage);
+        stats.FixedSteps = steps;
+        stats.MaxFixedSteps = std::max(stats.MaxFixedSteps, steps);
+        stats.DroppedTime = droppedTime;
+        stats.TotalDroppedTime += droppedTime;
 #endif
     }
 
-    void RunOneShotTask(Task* task)
+    static bool PopMaintenance(std::deque<MaintenanceJob>& queue, MaintenanceJob& job)
     {
-        if (!task)
-            return;
+        std::lock_guard<std::mutex> lock(MaintenanceLock);
+        if (queue.empty())
+            return false;
 
-        if (task->RunInMainThread)
-        {
-            task->Execute();
-        }
-        else
-        {
-            Threads[GetAvailableThread()]->AddTask(task);
-        }
+        job = std::move(queue.front());
+        queue.pop_front();
+        return true;
     }
 
-    bool IsIdle()
+    // runs one step, a job with more to do goes to the back so every job makes progress
+    static void StepMaintenance(std::deque<MaintenanceJob>& queue, MaintenanceJob& job)
     {
-        for (auto& thread : Threads)
+        bool more = false;
         {
-            if (!thread->IsIdle())
-                return false;
+            TRACE_ZONE_CAT(job.Name, "maintenance");
+            more = job.Step();
         }
 
-        return true;
+        if (!more)
+            return;
+
+        std::lock_guard<std::mutex> lock(MaintenanceLock);
+        queue.push_back(std::move(job));
     }
 
-    void CacheStageTask(Task* task)
+    static void RunMaintenanceUntil(std::deque<MaintenanceJob>& queue, int64_t deadline)
     {
-        if (!TasksPerStartStage.contains(task->StartingStage))
-        {
-            TasksPerStartStage.try_emplace(task->StartingStage);
-        }
-        TasksPerStartStage[task->StartingStage].push_back(task);
+        MaintenanceJob job;
+        while (TaskCounter::Now() < deadline && PopMaintenance(queue, job))
+            StepMaintenance(queue, job);
+    }
+
+    // Main thread jobs may touch anything the frame's tasks use. Worker tasks of the last stage only hold back
+    // the next frame's head, so they are waited on first, and only when there is a job. One step always runs, the
+    // rest only fit in the frame's slack: the time spent waiting on the swap, or the time left under the target
+    // frame time.
+    static void RunMainThreadMaintenance()
+    {
+        MaintenanceJob job;
+        if (!PopMaintenance(MainThreadMaintenance, job))
+            return;
+
+        WaitForStage(GetNextStage(FrameStage::FrameTail));
+
+        int64_t start = TaskCounter::Now();
+        StepMaintenance(MainThreadMaintenance, job);
 
-        if (!TasksBlockingStages.contains(task->GetBlocksStage()))
-            TasksBlockingStages.try_emplace(task->GetBlocksStage());
+        int64_t slack = std::max(SwapWaitTime, MaintenanceTargetFrameTime.load(std::memory_order_relaxed) - (start - FrameBeginTime));
+        int64_t budget = std::min(slack, MaintenanceBudget.load(std::memory_order_relaxed));
+        RunMaintenanceUntil(MainThreadMaintenance, start + budget);
     }
 
-    void AbortAll()
+    static void RunPoolMaintenance()
+    {
+        RunMaintenanceUntil(PoolMaintenance, TaskCounter::Now() + MaintenanceBudget.load(std::memory_order_relaxed));
+        PoolMaintenancePosted.store(false);
+    }
+
+    static void DrainMaintenance()
+    {
+        PoolMaintenancePosted.store(false);
+        RunMaintenanceUntil(PoolMaintenance, INT64_MAX);
+        RunMaintenanceUntil(MainThreadMaintenance, INT64_MAX);
+    }
+
+    // one runner per frame on the Idle lane, it only starts once the other lanes are empty
+    static void PostPoolMaintenance()
     {
-        for (auto& thread : Threads)
         {
-            thread->AbortTasks();
+            std::lock_guard<std::mutex> lock(MaintenanceLock);
+            if (PoolMaintenance.empty())
+                return;
         }
+
+        if (!PoolMaintenancePosted.exchange(true))
+            Post(TaskLane::Idle, &RunPoolMaintenance, "Maintenance");
+    }
+
+    void AddMaintenanceJob(const char* name, std::function<bool()> step, bool mainThread)
+    {
+        if (!step)
+            return;
+
+        std::lock_guard<std::mutex> lock(MaintenanceLock);
+        auto& queue = mainThread || Threads.empty() ? MainThreadMaintenance : PoolMaintenance;
+        queue.push_back(MaintenanceJob{ name, std::move(step) });
+    }
+
+    void SetMaintenancePolicy(const MaintenancePolicy& policy)
+    {
+        MaintenanceBudget.store(int64_t(double(policy.FrameBudget) * 1e9));
+        MaintenanceTargetFrameTime.store(int64_t(double(policy.TargetFrameTime) * 1e9));
+    }
+
+    MaintenancePolicy GetMaintenancePolicy()
+    {
+        MaintenancePolicy policy;
+        policy.FrameBudget = float(double(MaintenanceBudget.load()) / 1e9);
+        policy.TargetFrameTime = float(double(MaintenanceTargetFrameTime.load()) / 1e9);
+        return policy;
     }
-}
\ No newline at end of file
+
+    static bool BackgroundAvailable();
+
+    static void SetBackgroundOpen(bool open)
+    {
+        BackgroundOpen.store(open, std::memory_order_relaxed);
+        if (open && BackgroundAvailable())
+            WakeWorkers(Threads.size());
+    }
+
+    static void RunStage(FrameStage stage)
+    {
+        TRACE_ZONE_CAT(GetStageName(stage), "stage");
+
+        if (IsFixedStage(stage))
+        {
+            RunFixedLoop(stage);
+        }
+        else
+        {
+            RunTasksForStage(stage);
+            if (stage == FrameStage::Present)
+            {
+                // the swap wait is slack unless the simulation is still running on the pool
+                SetBackgroundOpen(!PipelineActive);
+                int64_t swapStart = TaskCounter::Now();
+                EndDrawing();
+                SwapWaitTime = TaskCounter::Now() - swapStart;
+                SetBackgroundOpen(false);
+            }
+        }
+    }
+
+    static void SortByPriority(std::vector<Task*>& tasks)
+    {
+        // insertion sort, the order barely changes between frames so this is close to one pass and never allocates
+        for (size_t i = 1; i < tasks.size(); i++)
+        {
+            Task* task = tasks[i];
+            size_t j = i;
+            for (; j > 0 && tasks[j - 1]->Priority < task->Priority; j--)
+                tasks[j] = tasks[j - 1];
+            tasks[j] = task;
+        }
+    }
+
+    // Orders every stage's task list longest path to the frame end first. A task's path is its own predicted
+    // duration plus the predicted makespan of every stage from the one it blocks onward, so long tasks and
+    // tasks holding the nearer barrier are handed out before short tasks with slack (LPT over the stage chain).
+    static void UpdateTaskPriorities()
+    {
+        for (auto& [task, taskId] : AllScheduledTasks)
+        {
+            if (!task->WasTickedThisFrame())
+                continue;
+
+            float duration = float(double(task->ExecuteTime.load(std::memory_order_relaxed)) / 1e9);
+            if (task->PredictedDuration == 0)
+                task->PredictedDuration = duration;
+            else
+                task->PredictedDuration += (duration - task->PredictedDuration) * DurationSmoothing;
+        }
+
+        // a stage can't finish before its longest task, or before the pool gets through all of its work
+        float workers = float(std::max<size_t>(1, Threads.size()));
+        for (FrameStage stage : StageOrder)
+        {
+            StageSchedule& stageSchedule = Schedule[size_t(stage)];
+            float longest = 0;
+            float total = 0;
+            for (auto* stageTasks : { &stageSchedule.WorkerTasks, &stageSchedule.MainThreadTasks })
+            {
+                for (Task* task : *stageTasks)
+                {
+                    longest = std::max(longest, task->PredictedDuration);
+                    total += task->PredictedDuration;
+                }
+            }
+            PredictedMakespan[size_t(stage)].store(std::max(longest, total / workers), std::memory_order_relaxed);
+        }
+
+        std::array<float, 256> pathToEnd = {};
+        float remaining = 0;
+        for (auto stage = StageOrder.rbegin(); stage != StageOrder.rend(); ++stage)
+        {
+            remaining += PredictedMakespan[size_t(*stage)].load(std::memory_order_relaxed);
+            pathToEnd[size_t(*stage)] = remaining;
+        }
+
+        for (FrameStage stage : StageOrder)
+        {
+            StageSchedule& stageSchedule = Schedule[size_t(stage)];
+            for (auto* stageTasks : { &stageSchedule.WorkerTasks, &stageSchedule.MainThreadTasks })
+            {
+                for (Task* task : *stageTasks)
+                    task->Priority = task->PredictedDuration + pathToEnd[size_t(task->GetBlocksStage())];
+
+                SortByPriority(*stageTasks);
+            }
+        }
+    }
+
+    static void AddBlock(std::vector<std::pair<FrameStage, uint32_t>>& blocks, FrameStage stage)
+    {
+        for (auto& [blocked, count] : blocks)
+        {
+            if (blocked == stage)
+            {
+                count++;
+                return;
+            }
+        }
+        blocks.emplace_back(stage, 1);
+    }
+
+    struct EdgeNode
+    {
+        enum class VisitState : uint8_t { Unvisited, Visiting, Resolved };
+        VisitState State = VisitState::Unvisited;
+
+        // the stage whose dispatch sets the task going
+        FrameStage Trigger = FrameStage::None;
+        std::vector<Task*> Accepted;
+    };
+
+    // stage from which a task's successors may be released, fixed update tasks release theirs once the stage
+    // they block starts since they run any number of times a frame
+    static FrameStage GetReadyStage(Task* task, const EdgeNode& node)
+    {
+        if (IsFixedStage(task->StartingStage))
+            return task->GetBlocksStage();
+        return node.Trigger;
+    }
+
+    static void WarnEdge(Task* task, Task* predecessor, const char* reason)
+    {
+        TraceLog(LOG_WARNING, "Task %s: ignoring edge after %s, %s", task->GetTaskName(), predecessor->GetTaskName(), reason);
+    }
+
+    // Accepts the edges that can't deadlock. A task dispatched by its predecessors must be released before the
+    // stage it blocks starts, and a main thread task can only wait for work that doesn't need the main thread
+    // later in the frame. Main thread tasks in the simulation stages run after the join when frames are
+    // pipelined, so only main thread tasks in those stages can follow them.
+    static FrameStage ResolveEdges(Task* task, std::unordered_map<Task*, EdgeNode>& nodes)
+    {
+        EdgeNode& node = nodes[task];
+        if (node.State == EdgeNode::VisitState::Resolved)
+            return node.Trigger;
+        if (node.State == EdgeNode::VisitState::Visiting)
+            return FrameStage::AutoNextState;
+
+        node.State = EdgeNode::VisitState::Visiting;
+        node.Trigger = task->StartingStage;
+
+        FrameStage start = task->StartingStage;
+        FrameStage blocks = task->GetBlocksStage();
+        bool canHaveEdges = IsStageDefined(start) && !IsFixedStage(start);
+
+        FrameStage trigger = FrameStage::FrameHead;
+        for (Task* predecessor : task->GetPredecessors())
+        {
+            if (!canHaveEdges)
+            {
+                WarnEdge(task, predecessor, "the task isn't scheduled once per frame");
+                continue;
+            }
+
+            auto predecessorNode = nodes.find(predecessor);
+            if (predecessorNode == nodes.end() || !IsStageDefined(predecessor->StartingStage))
+            {
+                WarnEdge(task, predecessor, "the predecessor isn't scheduled");
+                continue;
+            }
+
+            if (ResolveEdges(predecessor, nodes) == FrameStage::AutoNextState)
+            {
+                WarnEdge(task, predecessor, "the edges form a cycle");
+                continue;
+            }
+
+            FrameStage ready = GetReadyStage(predecessor, predecessorNode->second);
+            bool simulationMainThread = predecessor->RunInMainThread && IsSimulationStage(predecessor->StartingStage);
+
+            bool valid = false;
+            if (task->RunInMainThread)
+            {
+                // worker tasks dispatched by this stage go out before its main thread tasks run
+                bool sameStageWorker = ready == start && !predecessor->RunInMainThread && !predecessor->ReleasedByPredecessors;
+                bool pipelineSafe = !simulationMainThread || IsSimulationStage(start);
+                valid = (RunsBefore(ready, start) || sameStageWorker) && pipelineSafe;
+            }
+            else
+            {
+                valid = RunsBefore(ready, blocks) && !simulationMainThread;
+            }
+
+            if (!valid)
+            {
+                WarnEdge(task, predecessor, "it could deadlock the stages");
+                continue;
+            }
+
+            node.Accepted.push_back(predecessor);
+            if (RunsBefore(trigger, ready))
+                trigger = ready;
+        }
+
+        task->ReleasedByPredecessors = !task->RunInMainThread && !node.Accepted.empty();
+        if (task->ReleasedByPredecessors)
+            node.Trigger = trigger;
+
+        node.State = EdgeNode::VisitState::Resolved;
+        return node.Trigger;
+    }
+
+    static void CompileEdges()
+    {
+        std::unordered_map<Task*, EdgeNode> nodes;
+        for (auto& task : Tasks)
+        {
+            nodes.try_emplace(task.get());
+            task->Successors.clear();
+            task->PredecessorCount = 0;
+            task->ReleasedByPredecessors = false;
+        }
+
+        for (auto& task : Tasks)
+            ResolveEdges(task.get(), nodes);
+
+        for (auto& [task, node] : nodes)
+        {
+            if (node.Accepted.empty())
+                continue;
+
+            for (Task* predecessor : node.Accepted)
+            {
+                if (IsFixedStage(predecessor->StartingStage))
+                    Schedule[size_t(predecessor->GetBlocksStage())].Releases.push_back(task);
+                else
+                    predecessor->Successors.push_back(task);
+            }
+
+            task->PredecessorCount = uint32_t(node.Accepted.size());
+            ArmedTasks.push_back(task);
+        }
+    }
+
+    static void ScheduleTask(Task* task)
+    {
+        size_t taskId = task->TaskId();
+        AllScheduledTasks.emplace_back(task, taskId);
+
+        // a task added again after being removed starts from its old prediction
+        if (task->PredictedDuration == 0)
+        {
+            auto history = DurationHistory.find(taskId);
+            if (history != DurationHistory.end())
+                task->PredictedDuration = history->second;
+        }
+
+        if (!IsStageDefined(task->StartingStage))
+            return;
+
+        FrameStage blocks = task->GetBlocksStage();
+        task->StageCounter = &StageBlockers[size_t(blocks)];
+
+        if (task->ReleasedByPredecessors)
+        {
+            AddBlock(EdgeBlocks, blocks);
+            return;
+        }
+
+        StageSchedule& stageSchedule = Schedule[size_t(task->StartingStage)];
+        if (task->RunInMainThread)
+        {
+            stageSchedule.MainThreadTasks.push_back(task);
+            AddBlock(stageSchedule.MainThreadBlocks, blocks);
+        }
+        else
+        {
+            stageSchedule.WorkerTasks.push_back(task);
+            AddBlock(stageSchedule.WorkerBlocks, blocks);
+        }
+    }
+
+    // only for tasks without edges, see CanScheduleIncrementally
+    static void UnscheduleTask(Task* task)
+    {
+        std::erase_if(AllScheduledTasks, [task](const auto& entry) { return entry.first == task; });
+
+        if (!IsStageDefined(task->StartingStage))
+            return;
+
+        StageSchedule& stageSchedule = Schedule[size_t(task->StartingStage)];
+        auto& stageTasks = task->RunInMainThread ? stageSchedule.MainThreadTasks : stageSchedule.WorkerTasks;
+        auto& blocks = task->RunInMainThread ? stageSchedule.MainThreadBlocks : stageSchedule.WorkerBlocks;
+        std::erase(stageTasks, task);
+
+        FrameStage blocked = task->GetBlocksStage();
+        for (auto it = blocks.begin(); it != blocks.end(); ++it)
+        {
+            if (it->first != blocked)
+                continue;
+
+            if (--it->second == 0)
+                blocks.erase(it);
+            break;
+        }
+    }
+
+    // a task with no edges only touches its own stage's lists, anything else recompiles the whole schedule
+    static bool CanScheduleIncrementally(Task* task)
+    {
+        return !ScheduleDirty && task->GetPredecessors().empty() && task->Successors.empty() && !task->ReleasedByPredecessors;
+    }
+
+    static void CompileSchedule()
+    {
+        // nothing may be running while the task lists change, tasks started at the frame tail block the next head
+        WaitForStage(GetNextStage(FrameStage::FrameTail));
+
+        for (StageSchedule& stageSchedule : Schedule)
+        {
+            stageSchedule.WorkerTasks.clear();
+            stageSchedule.MainThreadTasks.clear();
+            stageSchedule.WorkerBlocks.clear();
+            stageSchedule.MainThreadBlocks.clear();
+            stageSchedule.Releases.clear();
+        }
+        AllScheduledTasks.clear();
+        ArmedTasks.clear();
+        EdgeBlocks.clear();
+
+        CompileEdges();
+
+        for (auto& task : Tasks)
+            ScheduleTask(task.get());
+
+        for (StageSchedule& stageSchedule : Schedule)
+        {
+            SortByPriority(stageSchedule.WorkerTasks);
+            SortByPriority(stageSchedule.MainThreadTasks);
+        }
+
+        ScheduleDirty = false;
+    }
+
+    static void PublishFrame()
+    {
+        for (auto& callback : FrameSyncCallbacks)
+            callback();
+    }
+
+    void TickFrame()
+    {
+        TRACE_BEGIN_FRAME();
+
+        CurrentRecord = &FlightRecorder::BeginFrame();
+        FrameIndex++;
+        FrameBeginTime = TaskCounter::Now();
+        SwapWaitTime = 0;
+
+        for (FrameStage stage : StageOrder)
+        {
+            SkippedTasks[size_t(stage)].store(0, std::memory_order_relaxed);
+            DeferredTasks[size_t(stage)].store(0, std::memory_order_relaxed);
+        }
+
+        SetBackgroundOpen(false);
+
+        ApplyTaskRequests();
+        if (ScheduleDirty)
+            CompileSchedule();
+        ReclaimRetiredTasks();
+
+        InFrame = true;
+
+        // tasks dispatched by their predecessors count against their stage from the start of the frame
+        for (auto [blocked, count] : EdgeBlocks)
+            StageBlockers[size_t(blocked)].Add(count);
+
+        for (Task* task : ArmedTasks)
+            task->PendingPredecessors.Add(task->PredecessorCount);
+
+        for (FrameStage stage : StageOrder)
+        {
+            if (IsFixedStage(stage))
+                FixedLoops[size_t(stage)].Accumulator += GetDeltaTime();
+        }
+
+        PipelineActive = PipelinedFrames.load() && !Threads.empty();
+
+#if defined(DEBUG)
+        for (FrameStage stage : StageOrder)
+            GetStatsForStage(stage).TickedThisFrame = false;
+#endif
+
+        ResumeFrameWaiters();
+
+        for (FrameStage stage : StageOrder)
+        {
+            if (IsPipelinedStage(stage))
+            {
+                // the whole simulation block runs on the pool while this thread renders the last published frame
+                if (stage == FirstSimulationStage)
+                {
+                    SimulationCounter.Add();
+                    PipelinedSimulation.CompletionCounter = &SimulationCounter;
+                    SubmitTask(&PipelinedSimulation);
+                }
+                continue;
+            }
+
+            RunStage(stage);
+        }
+
+        if (PipelineActive)
+        {
+            WaitForCounter(SimulationCounter);
+
+            for (FrameStage stage : GetSimulationStages())
+                DrainInbox(stage);
+
+            // main thread work from the simulation stages could not run on the pool
+            for (Task* task : DeferredMainThreadTasks)
+            {
+                task->CompletionCounter = task->StageCounter;
+                task->CompletionCounter->Add();
+                task->Execute();
+            }
+            DeferredMainThreadTasks.clear();
+
+            WaitForStage(FirstRenderStage);
+            PublishFrame();
+        }
+
+        InFrame = false;
+        SetBackgroundOpen(true);
+
+        // tasks removed during the frame must not be read below
+        ApplyTaskRequests();
+        if (ScheduleDirty)
+            CompileSchedule();
+
+        for (auto& [task, taskId] : AllScheduledTasks)
+        {
+            if (task->WasTickedThisFrame())
+                CurrentRecord->AddTask(task->GetTaskName(), taskId, float(double(task->ExecuteTime.load(std::memory_order_relaxed)) / 1e9));
+        }
+
+        for (FrameStage stage : StageOrder)
+        {
+            uint32_t skipped = SkippedTasks[size_t(stage)].load(std::memory_order_relaxed);
+            uint32_t deferred = DeferredTasks[size_t(stage)].load(std::memory_order_relaxed);
+            CurrentRecord->Stages[size_t(stage)].Skipped = skipped;
+            CurrentRecord->Stages[size_t(stage)].Deferred = deferred;
+#if defined(DEBUG)
+            auto& stats = GetStatsForStage(stage);
+            stats.SkippedTasks = skipped;
+            stats.DeferredTasks = deferred;
+            stats.TotalSkippedTasks += skipped;
+            stats.TotalDeferredTasks += deferred;
+#endif
+        }
+        FlightRecorder::EndFrame();
+        CurrentRecord = &ScratchRecord;
+        UpdateIdleMode();
+
+#if defined(DEBUG)
+        // dispatch until the stage's last task finished
+        for (FrameStage stage : StageOrder)
+        {
+            auto& stats = GetStatsForStage(stage);
+            if (!stats.TickedThisFrame)
+                continue;
+
+            int64_t lastFinish = StageDispatchTime[size_t(stage)];
+            StageSchedule& stageSchedule = Schedule[size_t(stage)];
+            for (auto* stageTasks : { &stageSchedule.WorkerTasks, &stageSchedule.MainThreadTasks })
+            {
+                for (Task* task : *stageTasks)
+                {
+                    if (task->WasTickedThisFrame())
+                        lastFinish = std::max(lastFinish, task->FinishTime.load(std::memory_order_relaxed));
+                }
+            }
+            stats.Makespan = double(lastFinish - StageDispatchTime[size_t(stage)]) / 1e9;
+        }
+#endif
+        UpdateTaskPriorities();
+
+        // last, a job may remove tasks and the lists above must not see that until the next compile
+        RunMainThreadMaintenance();
+        PostPoolMaintenance();
+
+        TRACE_END_FRAME();
+    }
+
+    bool DefineStage(const StageDefinition& definition)
+    {
+        FrameStage stage = definition.Id;
+        const char* name = definition.Name ? definition.Name : "Custom";
+        if (stage < FrameStage::FirstCustomStage || size_t(stage) >= StageSlotCount || IsStageDefined(stage))
+        {
+            TraceLog(LOG_WARNING, "Stage %s: id %d is not a free custom stage id", name, int(stage));
+            return false;
+        }
+
+        if (InFrame || CurrentWorker)
+        {
+            TraceLog(LOG_WARNING, "Stage %s: stages can only be defined on the main thread between frames", name);
+            return false;
+        }
+
+        if (!IsStageDefined(definition.After) || definition.After == FrameStage::FrameTail)
+        {
+            TraceLog(LOG_WARNING, "Stage %s: can't run after %s", name, GetStageName(definition.After));
+            return false;
+        }
+
+        // the new stage takes this position, the stage there now moves down one
+        size_t position = GetStagePosition(definition.After) + 1;
+        FrameStage blocks = definition.Blocks == FrameStage::AutoNextState ? StageOrder[position] : definition.Blocks;
+        if (!IsStageDefined(blocks) || GetStagePosition(blocks) < position)
+        {
+            TraceLog(LOG_WARNING, "Stage %s: can't block %s, it runs first", name, GetStageName(blocks));
+            return false;
+        }
+
+        if (definition.FixedRate > 0 && position > GetStagePosition(FirstRenderStage))
+        {
+            TraceLog(LOG_WARNING, "Stage %s: only stages before %s can have a fixed rate", name, GetStageName(FirstRenderStage));
+            return false;
+        }
+
+        // nothing may be running while the order changes, as with the schedule
+        WaitForStage(GetNextStage(FrameStage::FrameTail));
+
+        // the new stage goes in front of the one it displaces, whatever had to finish before that one now
+        // finishes before this one
+        FrameStage displaced = StageOrder[position];
+        for (FrameStage earlier : std::span<const FrameStage>(StageOrder).first(position))
+        {
+            if (StageBlocks[size_t(earlier)] == displaced)
+                StageBlocks[size_t(earlier)] = stage;
+        }
+
+        CustomStageNames[size_t(stage) - size_t(FrameStage::FirstCustomStage)] = name;
+        StageBlocks[size_t(stage)] = blocks;
+        StageOrder.insert(StageOrder.begin() + position, stage);
+        StagePositions = GetStagePositions(StageOrder);
+
+        if (definition.FixedRate > 0)
+            SetFixedRate(stage, definition.FixedRate);
+
+        InvalidateSchedule();
+        return true;
+    }
+
+    std::span<const FrameStage> GetStageOrder()
+    {
+        return StageOrder;
+    }
+
+    bool IsStageDefined(FrameStage stage)
+    {
+        return GetStagePosition(stage) != NotInFrame;
+    }
+
+    bool SetFixedRate(FrameStage stage, float stepsPerSecond)
+    {
+        if (InFrame || CurrentWorker)
+        {
+            TraceLog(LOG_WARNING, "Stage %s: fixed rates can only change on the main thread between frames", GetStageName(stage));
+            return false;
+        }
+
+        if (stepsPerSecond > 0 && !CanStep(stage))
+        {
+            TraceLog(LOG_WARNING, "Stage %s: only stages between %s and %s can have a fixed rate", GetStageName(stage), GetStageName(FrameStage::FrameHead), GetStageName(FirstRenderStage));
+            return false;
+        }
+
+        FixedLoop& loop = GetFixedLoop(stage);
+        float stepTime = stepsPerSecond > 0 ? 1.0f / stepsPerSecond : 0.0f;
+
+        // a loop that starts stepping has a step due on its first frame, like FixedUpdate
+        if (loop.StepTime.load() == 0)
+            loop.Accumulator = stepTime;
+
+        loop.StepTime.store(stepTime);
+        loop.StepsThisPass.store(1);
+        loop.Alpha.store(0);
+        return true;
+    }
+
+    float GetFixedRate(FrameStage stage)
+    {
+        float stepTime = GetFixedLoop(stage).StepTime.load(std::memory_order_relaxed);
+        return stepTime > 0 ? 1.0f / stepTime : 0.0f;
+    }
+
+    bool IsFixedStage(FrameStage stage)
+    {
+        return GetFixedLoop(stage).StepTime.load(std::memory_order_relaxed) > 0;
+    }
+
+    void SetFixedStepPolicy(const FixedStepPolicy& policy)
+    {
+        StepPolicy = policy;
+    }
+
+    const FixedStepPolicy& GetFixedStepPolicy()
+    {
+        return StepPolicy;
+    }
+
+    float GetFixedDeltaTime(FrameStage stage)
+    {
+        return GetFixedLoop(stage).StepTime.load(std::memory_order_relaxed);
+    }
+
+    uint32_t GetFixedStepCount(FrameStage stage)
+    {
+        return GetFixedLoop(stage).StepsThisPass.load(std::memory_order_relaxed);
+    }
+
+    float GetFixedAlpha(FrameStage stage)
+    {
+        return GetFixedLoop(stage).Alpha.load(std::memory_order_relaxed);
+    }
+
+    void SetPipelinedFrames(bool enabled)
+    {
+        PipelinedFrames.store(enabled);
+    }
+
+    bool IsPipelinedFrames()
+    {
+        return PipelinedFrames.load();
+    }
+
+    void AddFrameSyncCallback(std::function<void()> callback)
+    {
+        FrameSyncCallbacks.push_back(std::move(callback));
+    }
+
+    bool IsStageBlocked(FrameStage stage)
+    {
+        return !StageBlockers[size_t(stage)].IsDone();
+    }
+
+    void SetMainThreadHelpSlice(float seconds)
+    {
+        MainThreadHelpSlice.store(seconds);
+    }
+
+    float GetMainThreadHelpSlice()
+    {
+        return MainThreadHelpSlice.load();
+    }
+
+    // Runs queued pool tasks on the main thread while the stage is blocked, for at most the help slice so the
+    // stage's main thread tasks aren't held up. A task predicted to overrun the rest of the slice goes back on
+    // the main queue for the workers and the main thread parks instead.
+    static void HelpWhileBlocked(FrameStage stage)
+    {
+        float slice = MainThreadHelpSlice.load(std::memory_order_relaxed);
+        if (slice <= 0 || Threads.empty())
+            return;
+
+        TaskCounter& counter = StageBlockers[size_t(stage)];
+        int64_t start = TaskCounter::Now();
+        int64_t deadline = start + int64_t(double(slice) * 1e9);
+        uint32_t helped = 0;
+
+        while (!counter.IsDone())
+        {
+            int64_t now = TaskCounter::Now();
+            if (now >= deadline)
+                break;
+
+            Task* task = FindWork(nullptr);
+            if (!task)
+                break;
+
+            // the pipelined simulation driver would hold the main thread for the whole simulation
+            if (task == &PipelinedSimulation || task->PredictedDuration > float(double(deadline - now) / 1e9))
+            {
+                SubmitTask(task);
+                break;
+            }
+
+            TRACE_ZONE_CAT("Help", "wait");
+            RunFoundTask(task);
+            helped++;
+        }
+
+#if defined(DEBUG)
+        auto& stats = GetStatsForStage(stage);
+        stats.HelpedTasks += helped;
+        stats.HelpedDurration += double(TaskCounter::Now() - start) / 1e9;
+#else
+        (void)helped;
+#endif
+    }
+
+    void WaitForStage(FrameStage stage)
+    {
+        TRACE_ZONE_CAT(GetStageName(stage), "wait");
+
+        // a worker driving the pipelined simulation helps instead of parking
+        if (CurrentWorker)
+        {
+            WaitForCounter(StageBlockers[size_t(stage)]);
+            return;
+        }
+
+        if (std::this_thread::get_id() == MainThreadId)
+            HelpWhileBlocked(stage);
+
+        StageBlockers[size_t(stage)].Wait();
+    }
+
+    static uint32_t NextRandom()
+    {
+        thread_local uint32_t state = uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    static bool StealInjected(Task*& task)
+    {
+        if (InjectedCount.load(std::memory_order_acquire) == 0)
+            return false;
+
+        std::lock_guard<std::mutex> lock(InjectLock);
+        if (InjectedTasks.empty())
+            return false;
+
+        task = InjectedTasks.front();
+        InjectedTasks.pop_front();
+        InjectedCount.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    static bool PopLane(TaskLane lane, Task*& task)
+    {
+        LaneQueue& queue = Lanes[size_t(lane)];
+        if (queue.Count.load(std::memory_order_acquire) == 0)
+            return false;
+
+        std::lock_guard<std::mutex> lock(queue.Lock);
+        if (queue.Tasks.empty())
+            return false;
+
+        task = queue.Tasks.front();
+        queue.Tasks.pop_front();
+        queue.Count.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    static bool IsBackgroundLane(TaskLane lane)
+    {
+        return lane >= TaskLane::BackgroundIO;
+    }
+
+    static size_t GetBackgroundLimit()
+    {
+        if (BackgroundOpen.load(std::memory_order_relaxed))
+            return Threads.size();
+
+        return Topology.MaxBackgroundWorkers;
+    }
+
+    static bool BackgroundAvailable()
+    {
+        for (size_t lane = size_t(TaskLane::BackgroundIO); lane < TaskLaneCount; lane++)
+        {
+            if (Lanes[lane].Count.load(std::memory_order_acquire) > 0)
+                return BackgroundRunning.load(std::memory_order_relaxed) < GetBackgroundLimit();
+        }
+        return false;
+    }
+
+    // Background lanes take a slot under the cap before popping so concurrent workers can't overshoot it.
+    // The cap only gates starting a task, one already running when a frame starts finishes on its worker.
+    static Task* FindBackgroundWork()
+    {
+        size_t running = BackgroundRunning.load(std::memory_order_relaxed);
+        do
+        {
+            if (running >= GetBackgroundLimit())
+                return nullptr;
+        } while (!BackgroundRunning.compare_exchange_weak(running, running + 1, std::memory_order_acq_rel));
+
+        Task* task = nullptr;
+        for (TaskLane lane : { TaskLane::BackgroundIO, TaskLane::BackgroundDecode, TaskLane::Idle })
+        {
+            if (PopLane(lane, task))
+                return task;
+        }
+
+        BackgroundRunning.fetch_sub(1, std::memory_order_acq_rel);
+        return nullptr;
+    }
+
+    static Task* FindFrameWork(ThreadInfo* self)
+    {
+        Task* task = nullptr;
+        if (self && self->Tasks.Pop(task))
+            return task;
+
+        if (StealInjected(task))
+            return task;
+
+        // victims are every worker plus the main thread queue, start at a random one so thieves spread out
+        size_t victimCount = Threads.size() + 1;
+        size_t start = NextRandom() % victimCount;
+        for (size_t i = 0; i < victimCount; i++)
+        {
+            size_t victim = (start + i) % victimCount;
+            if (victim == Threads.size())
+            {
+                if (MainQueue.Steal(task))
+                    return task;
+            }
+            else if (Threads[victim].get() != self && Threads[victim]->Tasks.Steal(task))
+            {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    // frame lanes first, background lanes only when asked for (the workers' own loop), joins and the
+    // main thread never pick up a file read
+    Task* FindWork(ThreadInfo* self, bool background)
+    {
+        Task* task = FindFrameWork(self);
+        if (task)
+            return task;
+
+        if (PopLane(TaskLane::FrameNormal, task))
+            return task;
+
+        if (background)
+            return FindBackgroundWork();
+
+        return nullptr;
+    }
+
+    void FinishFoundTask(Task* task, TaskLane lane, bool owned)
+    {
+        if (owned)
+            delete task;
+
+        if (IsBackgroundLane(lane))
+        {
+            BackgroundRunning.fetch_sub(1, std::memory_order_acq_rel);
+
+            // the slot may be what held another worker back
+            if (BackgroundAvailable())
+                WakeWorkers(1);
+        }
+    }
+
+    static void RunFoundTask(Task* task)
+    {
+        TaskLane lane = task->Lane;
+        bool owned = task->OwnedByPool;
+        task->Execute();
+        FinishFoundTask(task, lane, owned);
+    }
+
+    bool HasPendingWork()
+    {
+        if (!MainQueue.Empty() || InjectedCount.load(std::memory_order_acquire) > 0)
+            return true;
+
+        if (Lanes[size_t(TaskLane::FrameNormal)].Count.load(std::memory_order_acquire) > 0 || BackgroundAvailable())
+            return true;
+
+        for (auto& thread : Threads)
+        {
+            if (!thread->Tasks.Empty())
+                return true;
+        }
+        return false;
+    }
+
+    void SetIdlePolicy(const WorkerIdlePolicy& policy)
+    {
+        IdleMode.store(policy.Mode);
+        IdleSpinNanoseconds.store(int64_t(double(policy.SpinMicroseconds) * 1e3));
+        IdleYieldCount.store(policy.YieldCount);
+        IdleSlackThreshold.store(policy.SlackThreshold);
+        ParkEagerly.store(policy.Mode == WorkerIdleMode::PowerSave);
+    }
+
+    WorkerIdlePolicy GetIdlePolicy()
+    {
+        WorkerIdlePolicy policy;
+        policy.Mode = IdleMode.load();
+        policy.SpinMicroseconds = float(double(IdleSpinNanoseconds.load()) / 1e3);
+        policy.YieldCount = IdleYieldCount.load();
+        policy.SlackThreshold = IdleSlackThreshold.load();
+        return policy;
+    }
+
+    WorkerIdleStats GetIdleStats(size_t worker)
+    {
+        WorkerIdleStats stats;
+        for (size_t i = 0; i < Threads.size(); i++)
+        {
+            if (worker != SIZE_MAX && worker != i)
+                continue;
+
+            stats.SpinHits += Threads[i]->SpinHits.load(std::memory_order_relaxed);
+            stats.YieldHits += Threads[i]->YieldHits.load(std::memory_order_relaxed);
+            stats.Parks += Threads[i]->Parks.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    static void UpdateIdleMode()
+    {
+        if (IdleMode.load(std::memory_order_relaxed) != WorkerIdleMode::Adaptive)
+            return;
+
+        const FlightRecorder::FrameRecord* frame = FlightRecorder::GetFrame(0);
+        if (frame && frame->FrameTime > 0)
+            ParkEagerly.store(frame->TickTime < frame->FrameTime * IdleSlackThreshold.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    // Stage transitions hand out work in bursts, a worker that polls for a moment picks up the next burst
+    // without paying for a futex wake and the scheduler latency. Spinning checks the queues between pause
+    // hints, yielding gives the core to other threads, and parking sleeps until a submit wakes the worker.
+    static bool SpinForWork(ThreadInfo* self)
+    {
+        if (ParkEagerly.load(std::memory_order_relaxed))
+            return false;
+
+        int64_t spinEnd = TaskCounter::Now() + IdleSpinNanoseconds.load(std::memory_order_relaxed);
+        do
+        {
+            for (int i = 0; i < 32; i++)
+                ThreadUtils::CpuRelax();
+
+            if (HasPendingWork() || !self->IsRunning())
+            {
+                self->SpinHits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        } while (TaskCounter::Now() < spinEnd);
+
+        uint32_t yields = IdleYieldCount.load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < yields; i++)
+        {
+            std::this_thread::yield();
+            if (HasPendingWork() || !self->IsRunning())
+            {
+                self->YieldHits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WaitForWork(ThreadInfo* self)
+    {
+        if (SpinForWork(self))
+            return;
+
+        // announce we are going to sleep before the final check, submitters read SleepingWorkers after publishing
+        SleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+        uint64_t epoch = WorkEpoch.load(std::memory_order_seq_cst);
+
+        if (!HasPendingWork() && self->IsRunning())
+        {
+            self->Parks.fetch_add(1, std::memory_order_relaxed);
+
+            std::unique_lock<std::mutex> lock(WakeLock);
+            WakeSignal.wait(lock, [self, epoch]() { return WorkEpoch.load() != epoch || !self->IsRunning(); });
+        }
+
+        SleepingWorkers.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void WakeWorkers(size_t count)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (SleepingWorkers.load(std::memory_order_seq_cst) == 0 && count != SIZE_MAX)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(WakeLock);
+            WorkEpoch.fetch_add(1);
+        }
+
+        if (count == 1)
+            WakeSignal.notify_one();
+        else
+            WakeSignal.notify_all();
+    }
+
+    static WorkStealingQueue<Task*>* GetSubmitQueue()
+    {
+        if (CurrentWorker)
+            return &CurrentWorker->Tasks;
+
+        if (std::this_thread::get_id() == MainThreadId)
+            return &MainQueue;
+
+        return nullptr;
+    }
+
+    void SubmitTask(Task* task)
+    {
+        if (!task)
+            return;
+
+        SubmitTasks(std::span<Task*>(&task, 1));
+    }
+
+    static void PushLane(Task* task)
+    {
+        LaneQueue& queue = Lanes[size_t(task->Lane)];
+        std::lock_guard<std::mutex> lock(queue.Lock);
+        queue.Tasks.push_back(task);
+        queue.Count.fetch_add(1, std::memory_order_release);
+    }
+
+    void SubmitTasks(std::span<Task*> tasks)
+    {
+        if (tasks.empty())
+            return;
+
+        // stage lists are all FrameCritical, only mixed submissions take the slow path
+        if (std::any_of(tasks.begin(), tasks.end(), [](Task* task) { return task->Lane != TaskLane::FrameCritical; }))
+        {
+            for (Task* task : tasks)
+            {
+                if (task->Lane == TaskLane::FrameCritical)
+                    SubmitTasks(std::span<Task*>(&task, 1));
+                else
+                    PushLane(task);
+            }
+            WakeWorkers(tasks.size());
+            return;
+        }
+
+        auto* queue = GetSubmitQueue();
+        if (queue)
+        {
+            queue->PushBulk(tasks);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(InjectLock);
+            InjectedTasks.insert(InjectedTasks.end(), tasks.begin(), tasks.end());
+            InjectedCount.fetch_add(tasks.size(), std::memory_order_release);
+        }
+
+        WakeWorkers(tasks.size());
+    }
+
+    void WaitForCounter(TaskCounter& counter)
+    {
+        if (counter.IsDone())
+            return;
+
+        TRACE_ZONE_CAT("Join", "wait");
+        while (!counter.IsDone())
+        {
+            // our own forks are on top of our deque so they usually come straight back to us
+            Task* task = FindWork(CurrentWorker);
+            if (task && !CurrentWorker && task == &PipelinedSimulation)
+            {
+                // same as HelpWhileBlocked, the main thread must not take over the simulation it is waiting on
+                SubmitTask(task);
+                task = nullptr;
+            }
+
+            if (task)
+            {
+                RunFoundTask(task);
+                continue;
+            }
+
+            // the rest of the group is running elsewhere, don't park since every worker
+            // could be sitting in a join and someone must keep draining the queues
+            std::this_thread::yield();
+        }
+    }
+
+    void Post(TaskLane lane, std::function<void()> work, const char* name)
+    {
+        if (Threads.empty())
+        {
+            work();
+            return;
+        }
+
+        LambdaTask* job = new LambdaTask(0, name, std::move(work));
+        job->Lane = lane;
+        job->OwnedByPool = true;
+        SubmitTask(job);
+    }
+
+    size_t GetWorkerCount()
+    {
+        return Threads.size();
+    }
+
+    struct ParallelJob;
+
+    class ParallelRangeTask : public Task
+    {
+    public:
+        DECLARE_TASK(ParallelRangeTask);
+        ParallelJob* Job = nullptr;
+
+    protected:
+        void Tick() override;
+    };
+
+    struct ParallelJob
+    {
+        std::atomic<size_t> Next = 0;
+        size_t End = 0;
+        size_t Grain = 1;
+        size_t Participants = 1;
+        const std::function<void(size_t, size_t)>* Func = nullptr;
+
+        // items whose chunk has returned, the caller is done once this reaches the range size
+        std::atomic<size_t> Finished = 0;
+
+        // helpers still queued or running, the job is not reused until they have all left it
+        TaskCounter Helpers;
+        std::vector<std::unique_ptr<ParallelRangeTask>> HelperTasks;
+
+        bool ClaimChunk(size_t& chunkBegin, size_t& chunkEnd)
+        {
+            // guided self scheduling, big chunks first then smaller ones to balance the tail
+            size_t next = Next.load(std::memory_order_relaxed);
+            if (next >= End)
+                return false;
+
+            size_t chunk = std::max(Grain, (End - next) / (Participants * 2));
+            chunkBegin = Next.fetch_add(chunk, std::memory_order_relaxed);
+            if (chunkBegin >= End)
+                return false;
+
+            chunkEnd = std::min(chunkBegin + chunk, End);
+            return true;
+        }
+
+        void Run()
+        {
+            size_t chunkBegin = 0;
+            size_t chunkEnd = 0;
+            while (ClaimChunk(chunkBegin, chunkEnd))
+            {
+                (*Func)(chunkBegin, chunkEnd);
+                Finished.fetch_add(chunkEnd - chunkBegin, std::memory_order_release);
+            }
+        }
+    };
+
+    void ParallelRangeTask::Tick()
+    {
+        Job->Run();
+    }
+
+    // jobs are recycled and never freed, a helper that was still queued when the caller returned
+    // finds the range exhausted and leaves, it must not find freed memory or another caller's range
+    std::mutex ParallelJobLock;
+    std::vector<std::unique_ptr<ParallelJob>> ParallelJobPool;
+    std::vector<ParallelJob*> FreeParallelJobs;
+
+    static ParallelJob* AcquireParallelJob()
+    {
+        std::lock_guard<std::mutex> lock(ParallelJobLock);
+        for (auto itr = FreeParallelJobs.begin(); itr != FreeParallelJobs.end(); ++itr)
+        {
+            ParallelJob* job = *itr;
+            if (!job->Helpers.IsDone())
+                continue;
+
+            FreeParallelJobs.erase(itr);
+            return job;
+        }
+
+        ParallelJobPool.push_back(std::make_unique<ParallelJob>());
+        return ParallelJobPool.back().get();
+    }
+
+    static void ReleaseParallelJob(ParallelJob* job)
+    {
+        std::lock_guard<std::mutex> lock(ParallelJobLock);
+        FreeParallelJobs.push_back(job);
+    }
+
+    void ParallelForRange(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& func)
+    {
+        if (end <= begin)
+            return;
+
+        grain = std::max<size_t>(grain, 1);
+        size_t count = end - begin;
+        if (Threads.empty() || count <= grain)
+        {
+            func(begin, end);
+            return;
+        }
+
+        ParallelJob* job = AcquireParallelJob();
+        job->Next.store(begin);
+        job->Finished.store(0);
+        job->End = end;
+        job->Grain = grain;
+        job->Func = &func;
+
+        size_t helperCount = std::min(Threads.size(), (count + grain - 1) / grain - 1);
+        job->Participants = helperCount + 1;
+
+        while (job->HelperTasks.size() < helperCount)
+            job->HelperTasks.push_back(std::make_unique<ParallelRangeTask>());
+
+        job->Helpers.Add(uint32_t(helperCount));
+        for (size_t i = 0; i < helperCount; i++)
+        {
+            job->HelperTasks[i]->Job = job;
+            job->HelperTasks[i]->CompletionCounter = &job->Helpers;
+            SubmitTask(job->HelperTasks[i].get());
+        }
+
+        // the caller works the range too, then waits for helpers that are still on a chunk. It does not run
+        // other pool tasks while it waits, callers iterate under their storage locks and a stolen task could
+        // change that storage under them
+        job->Run();
+        while (job->Finished.load(std::memory_order_acquire) < count)
+            std::this_thread::yield();
+
+        ReleaseParallelJob(job);
+    }
+
+    void SetStageBudget(FrameStage stage, float seconds)
+    {
+        StageBudgets[size_t(stage)].store(seconds);
+    }
+
+    float GetStageBudget(FrameStage stage)
+    {
+        return StageBudgets[size_t(stage)].load();
+    }
+
+    void SetFrameBudget(float seconds)
+    {
+        FrameBudget.store(seconds);
+    }
+
+    float GetFrameBudget()
+    {
+        return FrameBudget.load();
+    }
+
+    // Checked when the stage dispatches, against the critical path predictions. The frame check counts the
+    // stages left one after another, so with pipelined frames it errs towards shedding. Also called on workers
+    // releasing edge successors, possibly while the main thread is between frames, so it only reads atomics.
+    static bool IsOverBudget(FrameStage stage)
+    {
+        float stageBudget = StageBudgets[size_t(stage)].load(std::memory_order_relaxed);
+        if (stageBudget > 0 && PredictedMakespan[size_t(stage)].load(std::memory_order_relaxed) > stageBudget)
+            return true;
+
+        float frameBudget = FrameBudget.load(std::memory_order_relaxed);
+        if (frameBudget <= 0 || !InFrame.load(std::memory_order_relaxed))
+            return false;
+
+        float remaining = float(double(TaskCounter::Now() - FrameBeginTime.load(std::memory_order_relaxed)) / 1e9);
+        for (size_t position = GetStagePosition(stage); position < StageOrder.size(); position++)
+            remaining += PredictedMakespan[size_t(StageOrder[position])].load(std::memory_order_relaxed);
+        return remaining > frameBudget;
+    }
+
+    // Sheds the task from this frame if its importance allows, the caller counts it off its stage counter.
+    // Its successors are released here since they can't wait for a run that won't happen.
+    static bool TryShed(Task* task, bool overBudget)
+    {
+        if (!overBudget || task->Importance == TaskImportance::Required)
+            return false;
+
+        uint64_t frame = FrameIndex.load(std::memory_order_relaxed);
+        bool deferred = task->Importance == TaskImportance::Deferrable;
+        if (deferred && task->ShedFrame + 1 == frame)
+            return false;
+
+        task->ShedFrame = frame;
+        auto& counts = deferred ? DeferredTasks : SkippedTasks;
+        counts[size_t(task->StartingStage)].fetch_add(1, std::memory_order_relaxed);
+
+        if (!task->Successors.empty())
+            ReleaseSuccessors(task);
+        return true;
+    }
+
+    void RunTasksForStage(FrameStage stage)
+    {
+#if defined(DEBUG)
+        auto& stats = GetStatsForStage(stage);
+        stats.TaskCount = 0;
+        stats.HelpedTasks = 0;
+        stats.HelpedDurration = 0;
+        stats.BlockedDurration = 0;
+        stats.Durration = 0;
+        stats.StartTime = GetTime();
+        stats.TickedThisFrame = true;
+#endif
+        FlightRecorder::StageSample& sample = CurrentRecord->Stages[size_t(stage)];
+        int64_t stageStart = TaskCounter::Now();
+        uint32_t taskCount = 0;
+
+        bool pipelined = IsPipelinedStage(stage);
+
+        // when pipelined the render stages draw the published frame and don't wait on the simulation
+        bool waitForBlockers = !(PipelineActive && stage == FirstRenderStage);
+        if (waitForBlockers && IsStageBlocked(stage))
+        {
+            WaitForStage(stage);
+            sample.Blocked += float(double(TaskCounter::Now() - stageStart) / 1e9);
+#if defined(DEBUG)
+            stats.WakeLatency = StageBlockers[size_t(stage)].GetWakeLatency();
+            if (stats.WakeLatency > stats.MaxWakeLatency)
+                stats.MaxWakeLatency = stats.WakeLatency;
+
+            stats.BlockedDurration = GetTime() - stats.StartTime;
+
+            if (stats.BlockedDurration > stats.MaxBlockedDurration)
+                stats.MaxBlockedDurration = stats.BlockedDurration;
+#endif
+        }
+#if defined(DEBUG)
+        else
+        {
+            stats.WakeLatency = 0;
+        }
+#endif
+        if (!pipelined)
+            DrainInbox(stage);
+
+        StageDispatchTime[size_t(stage)] = TaskCounter::Now();
+#if defined(DEBUG)
+        stats.PredictedMakespan = PredictedMakespan[size_t(stage)].load(std::memory_order_relaxed);
+#endif
+
+        // simulation output is complete once the first render stage is unblocked
+        if (!PipelineActive && stage == FirstRenderStage)
+            PublishFrame();
+
+        if (!InFrame && !CurrentWorker)
+        {
+            ApplyTaskRequests();
+            if (ScheduleDirty)
+                CompileSchedule();
+        }
+
+        StageSchedule& stageSchedule = Schedule[size_t(stage)];
+
+        // the fixed update tasks holding these are done once the stage is unblocked
+        if (!stageSchedule.Releases.empty())
+        {
+            if (!waitForBlockers)
+                WaitForStage(stage);
+
+            for (Task* task : stageSchedule.Releases)
+                ReleaseTask(task);
+        }
+        uint32_t stepRepeats = IsFixedStage(stage) ? FixedLoops[size_t(stage)].StepsThisPass.load() : 1;
+
+        // count the tasks against the stages they block, Execute releases the counter when done
+        for (auto [blocked, count] : stageSchedule.WorkerBlocks)
+            StageBlockers[size_t(blocked)].Add(count);
+
+        if (!pipelined)
+        {
+            for (auto [blocked, count] : stageSchedule.MainThreadBlocks)
+                StageBlockers[size_t(blocked)].Add(count);
+        }
+
+        bool overBudget = IsOverBudget(stage);
+
+        std::vector<Task*>* workerTasks = &stageSchedule.WorkerTasks;
+        if (overBudget)
+        {
+            stageSchedule.Kept.clear();
+            for (Task* task : stageSchedule.WorkerTasks)
+            {
+                if (TryShed(task, true))
+                    task->StageCounter->Release();
+                else
+                    stageSchedule.Kept.push_back(task);
+            }
+            workerTasks = &stageSchedule.Kept;
+        }
+
+        TaskCounter* stepCounter = nullptr;
+        if (IsFixedStage(stage))
+        {
+            stepCounter = &FixedLoops[size_t(stage)].StepTasks;
+            stepCounter->Add(uint32_t(workerTasks->size()));
+        }
+
+        for (Task* task : *workerTasks)
+        {
+            task->StepRepeats = task->StepIndependent ? 1 : stepRepeats;
+            task->CompletionCounter = task->StageCounter;
+            task->StepCounter = stepCounter;
+        }
+        SubmitTasks(*workerTasks);
+        taskCount += uint32_t(workerTasks->size());
+
+        for (Task* task : stageSchedule.MainThreadTasks)
+        {
+            task->StepRepeats = task->StepIndependent ? 1 : stepRepeats;
+
+            // pipelined main thread tasks are only counted against their stage once they run
+            if (TryShed(task, overBudget))
+            {
+                if (!pipelined)
+                    task->StageCounter->Release();
+                continue;
+            }
+
+            if (pipelined)
+            {
+                DeferredMainThreadTasks.push_back(task);
+                continue;
+            }
+
+            task->CompletionCounter = task->StageCounter;
+            task->Execute();
+            taskCount++;
+        }
+
+        sample.Duration += float(double(TaskCounter::Now() - stageStart) / 1e9);
+        sample.TaskCount += taskCount;
+
+#if defined(DEBUG)
+        stats.TaskCount = taskCount;
+        stats.EndTime = GetTime();
+        stats.Durration = stats.EndTime - stats.StartTime;
+        if (stats.Durration > stats.MaxDurration)
+            stats.MaxDurration = stats.Durration;
+#endif
+    }
+
+    void RunOneShotTask(Task* task)
+    {
+        if (!task)
+            return;
+
+        task->CompletionCounter = nullptr;
+        task->StepCounter = nullptr;
+        task->StepRepeats = 1;
+
+        if (task->RunInMainThread)
+        {
+            task->Execute();
+        }
+        else
+        {
+            SubmitTask(task);
+        }
+    }
+
+    bool IsIdle()
+    {
+        if (!MainQueue.Empty() || InjectedCount.load() > 0)
+            return false;
+
+        for (LaneQueue& lane : Lanes)
+        {
+            if (lane.Count.load() > 0)
+                return false;
+        }
+
+        for (auto& thread : Threads)
+        {
+            if (!thread->IsIdle())
+                return false;
+        }
+
+        return true;
+    }
+
+    static bool IsMainThreadBetweenFrames()
+    {
+        return !CurrentWorker && std::this_thread::get_id() == MainThreadId && !InFrame;
+    }
+
+    static void QueueTaskRequest(TaskRequest* request)
+    {
+        request->Next = PendingTaskRequests.load(std::memory_order_relaxed);
+        while (!PendingTaskRequests.compare_exchange_weak(request->Next, request, std::memory_order_release, std::memory_order_relaxed)) {}
+
+        if (IsMainThreadBetweenFrames())
+            ApplyTaskRequests();
+    }
+
+    void AddTask(std::unique_ptr<Task> task)
+    {
+        if (!task)
+            return;
+
+        QueueTaskRequest(new TaskRequest{ .Added = std::move(task) });
+    }
+
+    void RemoveTask(Task* task)
+    {
+        if (!task)
+            return;
+
+        QueueTaskRequest(new TaskRequest{ .Removed = task });
+    }
+
+    void RemoveTasksWithId(size_t taskId)
+    {
+        QueueTaskRequest(new TaskRequest{ .RemovedId = taskId, .RemoveById = true });
+    }
+
+    static void RetireTask(std::unique_ptr<Task> task)
+    {
+        // kept so the prediction survives the task being added again
+        if (task->PredictedDuration > 0)
+            DurationHistory[task->TaskId()] = task->PredictedDuration;
+
+        // an edge removed here dirties the schedule, so the check below falls back to a full compile
+        // entries already moved out of Tasks by the caller are empty
+        for (auto& other : Tasks)
+        {
+            if (other)
+                other->RemovePredecessor(task.get());
+        }
+
+        if (CanScheduleIncrementally(task.get()))
+            UnscheduleTask(task.get());
+        else
+            ScheduleDirty = true;
+
+        RetiredTasks.emplace_back(ReclaimEpoch.load(), std::move(task));
+    }
+
+    // main thread between frames, requests are applied in the order they were queued
+    static void ApplyTaskRequests()
+    {
+        if (!PendingTaskRequests.load(std::memory_order_relaxed))
+            return;
+
+        TaskRequest* request = PendingTaskRequests.exchange(nullptr, std::memory_order_acquire);
+
+        // the list is newest first
+        TaskRequest* ordered = nullptr;
+        while (request)
+        {
+            TaskRequest* next = request->Next;
+            request->Next = ordered;
+            ordered = request;
+            request = next;
+        }
+
+        while (ordered)
+        {
+            TaskRequest* next = ordered->Next;
+            if (ordered->Added)
+            {
+                Task* task = ordered->Added.get();
+                Tasks.push_back(std::move(ordered->Added));
+
+                if (CanScheduleIncrementally(task))
+                {
+                    ScheduleTask(task);
+                    if (IsStageDefined(task->StartingStage))
+                    {
+                        StageSchedule& stageSchedule = Schedule[size_t(task->StartingStage)];
+                        SortByPriority(task->RunInMainThread ? stageSchedule.MainThreadTasks : stageSchedule.WorkerTasks);
+                    }
+                }
+                else
+                {
+                    ScheduleDirty = true;
+                }
+            }
+            else
+            {
+                for (auto& task : Tasks)
+                {
+                    bool matches = ordered->RemoveById ? task->TaskId() == ordered->RemovedId : task.get() == ordered->Removed;
+                    if (matches)
+                        RetireTask(std::move(task));
+                }
+                std::erase(Tasks, nullptr);
+            }
+
+            delete ordered;
+            ordered = next;
+        }
+    }
+
+    // Frees the retired tasks no thread can still be running. Once the frame tail tasks are done nothing scheduled
+    // is queued, so only a worker still inside Execute can hold one, and it pinned an epoch no later than the
+    // task's retire epoch before it found the task.
+    static void ReclaimRetiredTasks()
+    {
+        if (RetiredTasks.empty())
+            return;
+
+        WaitForStage(GetNextStage(FrameStage::FrameTail));
+
+        uint64_t oldest = ReclaimEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        for (auto& thread : Threads)
+            oldest = std::min(oldest, thread->PinnedEpoch.load(std::memory_order_seq_cst));
+
+        std::erase_if(RetiredTasks, [oldest](const auto& retired) { return retired.first < oldest; });
+    }
+
+    uint64_t GetReclaimEpoch()
+    {
+        return ReclaimEpoch.load(std::memory_order_seq_cst);
+    }
+
+    void InvalidateSchedule()
+    {
+        ScheduleDirty = true;
+    }
+
+    static void ReleaseTask(Task* task)
+    {
+        // nothing is armed outside of TickFrame
+        if (task->PendingPredecessors.IsDone())
+            return;
+
+        if (!task->PendingPredecessors.Release() || !task->ReleasedByPredecessors)
+            return;
+
+        if (TryShed(task, IsOverBudget(task->StartingStage)))
+        {
+            task->StageCounter->Release();
+            return;
+        }
+
+        task->StepRepeats = 1;
+        task->CompletionCounter = task->StageCounter;
+        task->StepCounter = nullptr;
+        SubmitTask(task);
+    }
+
+    void ReleaseSuccessors(Task* task)
+    {
+        for (Task* successor : task->Successors)
+            ReleaseTask(successor);
+    }
+
+    void AbortAll()
+    {
+        for (auto& thread : Threads)
+        {
+            thread->AbortTasks();
+        }
+    }
+}
+namespace UnitTest
+{
+    class ScheduleBenchmarkTask : public Task
+    {
+    public:
+        DECLARE_TASK(ScheduleBenchmarkTask);
+        ScheduleBenchmarkTask(FrameStage stage, bool mainThread) : Task(stage, mainThread) {}
+
+    protected:
+        void Tick() override {}
+    };
+
+    class ScheduleChurnTask : public Task
+    {
+    public:
+        DECLARE_TASK(ScheduleChurnTask);
+        ScheduleChurnTask() : Task(FrameStage::Update, false) {}
+
+    protected:
+        void Tick() override {}
+    };
+
+    static double TimeFrames(size_t frames, bool churn)
+    {
+        int64_t start = TaskCounter::Now();
+        for (size_t frame = 0; frame < frames; frame++)
+        {
+            if (churn)
+                TaskManager::AddTask<ScheduleChurnTask>();
+
+            TaskManager::TickFrame();
+
+            if (churn)
+                TaskManager::RemoveTask<ScheduleChurnTask>();
+        }
+        return double(TaskCounter::Now() - start) / double(frames);
+    }
+
+    // Scheduler cost per frame with empty tasks spread over the update and draw stages, steady and with a
+    // task added and removed every frame. Run on its own, other registered tasks are timed too.
+    int TaskScheduleBenchmark()
+    {
+        constexpr size_t Frames = 500;
+        bool ownsPool = TaskManager::GetWorkerCount() == 0;
+        if (ownsPool)
+            TaskManager::Init();
+
+        for (size_t taskCount : { 16, 256, 4096 })
+        {
+            for (size_t i = 0; i < taskCount; i++)
+            {
+                FrameStage stage = FrameStage(size_t(FrameStage::PreUpdate) + i % (size_t(FrameStage::PostDraw) - size_t(FrameStage::PreUpdate) + 1));
+                TaskManager::AddTaskOnState<ScheduleBenchmarkTask>(stage, stage, i % 8 == 0);
+            }
+
+            TimeFrames(10, false);
+            double steady = TimeFrames(Frames, false);
+            double churn = TimeFrames(Frames, true);
+
+            TraceLog(LOG_INFO, "Task schedule: %zu tasks, %.1f us per frame (%.1f ns per task), %.1f us with churn",
+                taskCount, steady / 1e3, steady / double(taskCount), churn / 1e3);
+
+            TaskManager::RemoveTask<ScheduleBenchmarkTask>();
+            TaskManager::TickFrame();
+        }
+
+        if (ownsPool)
+            TaskManager::Shutdown();
+
+        return 0;
+    }
+
+    class FixedEdgeStepTask : public Task
+    {
+    public:
+        DECLARE_TASK(FixedEdgeStepTask);
+        FixedEdgeStepTask() : Task(FrameStage::FixedUpdate, false) {}
+        std::atomic<uint32_t> Ticks = 0;
+
+    protected:
+        void Tick() override { Ticks++; }
+    };
+
+    class FixedEdgeTriggerTask : public Task
+    {
+    public:
+        DECLARE_TASK(FixedEdgeTriggerTask);
+        FixedEdgeTriggerTask() : Task(FrameStage::Update, false) {}
+
+    protected:
+        void Tick() override {}
+    };
+
+    class FixedEdgeSuccessorTask : public Task
+    {
+    public:
+        DECLARE_TASK(FixedEdgeSuccessorTask);
+        FixedEdgeSuccessorTask() : Task(FrameStage::Update, false) {}
+        std::atomic<uint32_t> Ticks = 0;
+
+    protected:
+        void Tick() override { Ticks++; }
+    };
+
+    // Several fixed steps a frame, stepped one at a time, with an edge released task that counts against the
+    // stage FixedUpdate blocks but can only be released once Update dispatches. The wait between steps must not
+    // include it. A regression hangs in the second frame.
+    int FixedStepEdgeTest()
+    {
+        constexpr uint32_t Frames = 20;
+        constexpr uint32_t StepsPerFrame = 3;
+        bool ownsPool = TaskManager::GetWorkerCount() == 0;
+        if (ownsPool)
+            TaskManager::Init();
+
+        FixedStepPolicy oldPolicy = TaskManager::GetFixedStepPolicy();
+        FixedStepPolicy policy = oldPolicy;
+        policy.BatchCatchUp = false;
+        policy.MaxStepsPerFrame = std::max(policy.MaxStepsPerFrame, StepsPerFrame + 1);
+        TaskManager::SetFixedStepPolicy(policy);
+
+        auto* stepTask = TaskManager::AddTask<FixedEdgeStepTask>();
+        auto* trigger = TaskManager::AddTask<FixedEdgeTriggerTask>();
+        auto* successor = TaskManager::AddTask<FixedEdgeSuccessorTask>();
+        successor->After(trigger);
+
+        TaskManager::FixedLoop& loop = TaskManager::FixedLoops[size_t(FrameStage::FixedUpdate)];
+        for (uint32_t frame = 0; frame < Frames; frame++)
+        {
+            // due steps on top of whatever the frame time adds
+            loop.Accumulator += loop.StepTime.load() * float(StepsPerFrame);
+            TaskManager::TickFrame();
+        }
+
+        int failures = 0;
+        if (stepTask->Ticks.load() < Frames * StepsPerFrame || successor->Ticks.load() != Frames)
+        {
+            TraceLog(LOG_WARNING, "Fixed step edges: %u steps (at least %u), successor ran %u of %u frames",
+                stepTask->Ticks.load(), Frames * StepsPerFrame, successor->Ticks.load(), Frames);
+            failures++;
+        }
+
+        TaskManager::RemoveTask<FixedEdgeStepTask>();
+        TaskManager::RemoveTask<FixedEdgeTriggerTask>();
+        TaskManager::RemoveTask<FixedEdgeSuccessorTask>();
+        TaskManager::TickFrame();
+        TaskManager::SetFixedStepPolicy(oldPolicy);
+
+        if (ownsPool)
+            TaskManager::Shutdown();
+
+        TraceLog(LOG_INFO, "Fixed step edges: %s", failures == 0 ? "passed" : "failed");
+        return failures;
+    }
+}
+
+const char* GetCustomStageName(FrameStage state)
+{
+    if (state < FrameStage::FirstCustomStage || !TaskManager::IsStageDefined(state))
+        return "Unknown";
+
+    return TaskManager::CustomStageNames[size_t(state) - size_t(FrameStage::FirstCustomStage)];
+}
+
+FrameStage GetNextStage(FrameStage state)
+{
+    if (size_t(state) >= StageSlotCount)
+        return FrameStage::None;
+
+    return TaskManager::StageBlocks[size_t(state)];
+}
@@ -6,6 +6,7 @@
 
 #include "ThreadedProcessor.h"
 #include "ResourceManager.h"
+#include "ThreadUtils.h"
 
 namespace TextureManager
 {
@@ -22,6 +23,7 @@ namespace TextureManager
         ResourceManager::ResourceInfoRef Resource;
     };
 
+    // uploads need the loader window's GL context current, so they keep a thread of their own instead of the worker pool
     ThreadedProcessor<PendingTextureLoad> TextureLoaderThread;
 
     void Init()
@@ -35,7 +37,9 @@ namespace TextureManager
         LoaderWindow = glfwCreateWindow(1, 1, "TempWindow", NULL, glfwGetCurrentContext());
         glfwHideWindow(LoaderWindow);
 
+        TextureLoaderThread.SetName("Texture Loader");
         TextureLoaderThread.SetOnThreadStart([]() {
+            ThreadUtils::PinCurrentThreadToReservedCores();
             glfwMakeContextCurrent(LoaderWindow);
             });
 
@@ -0,0 +1,90 @@
+#include "ThreadUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#endif
+
+namespace ThreadUtils
+{
+    std::atomic<size_t> ReservedFirstCore = 0;
+    std::atomic<size_t> ReservedCoreCount = 0;
+
+    size_t GetHardwareThreadCount()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    void SetCurrentThreadName(const char* name)
+    {
+#if defined(_WIN32)
+        std::wstring wideName(name, name + strlen(name));
+        SetThreadDescription(GetCurrentThread(), wideName.c_str());
+#elif defined(__APPLE__)
+        pthread_setname_np(name);
+#elif defined(__linux__)
+        std::string shortName(name);
+        if (shortName.size() > 15)
+            shortName.resize(15);
+        pthread_setname_np(pthread_self(), shortName.c_str());
+#else
+        (void)name;
+#endif
+    }
+
+    bool PinCurrentThread(size_t firstCore, size_t count)
+    {
+        size_t hardwareThreads = GetHardwareThreadCount();
+        if (count == 0 || firstCore >= hardwareThreads)
+            return false;
+
+        count = std::min(count, hardwareThreads - firstCore);
+
+#if defined(_WIN32)
+        if (firstCore + count > sizeof(DWORD_PTR) * 8)
+            return false;
+
+        DWORD_PTR mask = 0;
+        for (size_t core = firstCore; core < firstCore + count; core++)
+            mask |= DWORD_PTR(1) << core;
+
+        return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t core = firstCore; core < firstCore + count; core++)
+            CPU_SET(core, &set);
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    void SetReservedCores(size_t firstCore, size_t count)
+    {
+        ReservedFirstCore.store(firstCore);
+        ReservedCoreCount.store(count);
+    }
+
+    bool PinCurrentThreadToReservedCores()
+    {
+        size_t count = ReservedCoreCount.load();
+        if (count == 0)
+            return false;
+
+        return PinCurrentThread(ReservedFirstCore.load(), count);
+    }
+}
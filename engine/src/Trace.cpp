@@ -0,0 +1,229 @@
+#include "Trace.h"
+
+#include "raylib.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Trace
+{
+    struct Event
+    {
+        const char* Name = nullptr;
+        const char* Category = nullptr;
+        int64_t Start = 0;
+        int64_t End = 0;
+    };
+
+    static constexpr uint32_t EventsPerThread = 1 << 15;
+
+    // written only by the owning thread, the exporter reads the first Count events
+    struct ThreadBuffer
+    {
+        uint32_t ThreadIndex = 0;
+        std::string Name;
+
+        std::unique_ptr<Event[]> Events;
+        std::atomic<uint32_t> Count = 0;
+        std::atomic<uint32_t> Dropped = 0;
+        std::atomic<uint32_t> Generation = 0;
+    };
+
+    // buffers are never freed, a thread may still hold its pointer after the capture ends
+    std::mutex RegistryLock;
+    std::vector<std::unique_ptr<ThreadBuffer>> ThreadBuffers;
+    thread_local ThreadBuffer* LocalBuffer = nullptr;
+
+    std::atomic<bool> Recording = false;
+    std::atomic<uint32_t> CaptureGeneration = 0;
+
+    std::mutex CaptureLock;
+    uint32_t RequestedFrames = 0;
+    std::string RequestedPath;
+
+    // main thread only
+    uint32_t FramesLeft = 0;
+    std::string CapturePath;
+    int64_t CaptureStart = 0;
+    int64_t FrameStart = 0;
+
+    static ThreadBuffer* GetLocalBuffer()
+    {
+        if (LocalBuffer)
+            return LocalBuffer;
+
+        std::lock_guard<std::mutex> lock(RegistryLock);
+        ThreadBuffers.push_back(std::make_unique<ThreadBuffer>());
+        LocalBuffer = ThreadBuffers.back().get();
+        LocalBuffer->ThreadIndex = uint32_t(ThreadBuffers.size());
+        LocalBuffer->Name = "Thread " + std::to_string(LocalBuffer->ThreadIndex);
+        return LocalBuffer;
+    }
+
+    int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void SetThreadName(const char* name)
+    {
+        ThreadBuffer* buffer = GetLocalBuffer();
+
+        std::lock_guard<std::mutex> lock(RegistryLock);
+        buffer->Name = name;
+    }
+
+    void RecordZone(const char* name, const char* category, int64_t start, int64_t end)
+    {
+        if (!Recording.load(std::memory_order_acquire))
+            return;
+
+        ThreadBuffer* buffer = GetLocalBuffer();
+
+        // first event of a new capture, forget the previous one
+        uint32_t generation = CaptureGeneration.load(std::memory_order_acquire);
+        if (buffer->Generation.load(std::memory_order_relaxed) != generation)
+        {
+            buffer->Generation.store(generation, std::memory_order_relaxed);
+            buffer->Dropped.store(0, std::memory_order_relaxed);
+            buffer->Count.store(0, std::memory_order_release);
+        }
+
+        if (!buffer->Events)
+            buffer->Events = std::make_unique<Event[]>(EventsPerThread);
+
+        uint32_t count = buffer->Count.load(std::memory_order_relaxed);
+        if (count >= EventsPerThread)
+        {
+            buffer->Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        buffer->Events[count] = Event{ name, category, start, end };
+        buffer->Count.store(count + 1, std::memory_order_release);
+    }
+
+    void Capture(uint32_t frameCount, const std::string& path)
+    {
+#if defined(ENGINE_TRACING)
+        std::lock_guard<std::mutex> lock(CaptureLock);
+        RequestedFrames = frameCount;
+        RequestedPath = path;
+#else
+        (void)frameCount;
+        (void)path;
+        TraceLog(LOG_WARNING, "Trace capture requested but tracing is not compiled in (premake5 --tracing=on)");
+#endif
+    }
+
+    bool IsCapturing()
+    {
+        return Recording.load(std::memory_order_relaxed);
+    }
+
+    static void WriteString(std::ofstream& out, const char* text)
+    {
+        out << '"';
+        for (const char* c = text; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                out << '\\';
+            out << *c;
+        }
+        out << '"';
+    }
+
+    static void WriteCapture()
+    {
+        std::ofstream out(CapturePath, std::ios::binary);
+        if (!out)
+        {
+            TraceLog(LOG_ERROR, "Unable to write trace file %s", CapturePath.c_str());
+            return;
+        }
+
+        uint32_t generation = CaptureGeneration.load(std::memory_order_relaxed);
+        size_t eventCount = 0;
+        uint32_t dropped = 0;
+        bool first = true;
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+        std::lock_guard<std::mutex> lock(RegistryLock);
+        for (auto& buffer : ThreadBuffers)
+        {
+            if (!first)
+                out << ",\n";
+            first = false;
+
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->ThreadIndex << ",\"args\":{\"name\":";
+            WriteString(out, buffer->Name.c_str());
+            out << "}}";
+
+            // a thread that recorded nothing this capture still holds the previous capture's events
+            uint32_t count = buffer->Count.load(std::memory_order_acquire);
+            if (buffer->Generation.load(std::memory_order_relaxed) != generation)
+                continue;
+
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const Event& event = buffer->Events[i];
+
+                out << ",\n{\"name\":";
+                WriteString(out, event.Name);
+                out << ",\"cat\":";
+                WriteString(out, event.Category);
+                out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->ThreadIndex
+                    << ",\"ts\":" << double(event.Start - CaptureStart) / 1000.0
+                    << ",\"dur\":" << double(event.End - event.Start) / 1000.0 << "}";
+            }
+
+            eventCount += count;
+            dropped += buffer->Dropped.load(std::memory_order_relaxed);
+        }
+
+        out << "\n]}\n";
+
+        TraceLog(LOG_INFO, "Wrote %zu trace events (%u dropped) to %s", eventCount, dropped, CapturePath.c_str());
+    }
+
+    void BeginFrame()
+    {
+        if (!Recording.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(CaptureLock);
+            if (RequestedFrames == 0)
+                return;
+
+            FramesLeft = RequestedFrames;
+            CapturePath = RequestedPath;
+            RequestedFrames = 0;
+            CaptureStart = Now();
+
+            CaptureGeneration.fetch_add(1, std::memory_order_release);
+            Recording.store(true, std::memory_order_release);
+        }
+
+        FrameStart = Now();
+    }
+
+    void EndFrame()
+    {
+        if (!Recording.load(std::memory_order_relaxed))
+            return;
+
+        RecordZone("Frame", "frame", FrameStart, Now());
+
+        if (--FramesLeft > 0)
+            return;
+
+        // threads that already passed the recording check may still append, the exporter only reads published events
+        Recording.store(false, std::memory_order_release);
+        WriteCapture();
+    }
+}
@@ -4,6 +4,7 @@
 #include "raymath.h"
 #include "ValueTracker.h"
 #include "ComponentReader.h"
+#include "FrameStage.h"
 
 #include <atomic>
 
@@ -16,6 +17,9 @@ extern std::atomic<BoundingBox2D> WorldBounds;
 
 extern bool UseInterpolateNPCs;
 
+// spawning decisions don't need the simulation rate, they run at 10 Hz alongside Update
+static constexpr StageDefinition AIStage{ .Id = CustomStage(0), .Name = "AI", .After = FrameStage::FixedUpdate, .FixedRate = 10.0f, .Blocks = FrameStage::PostUpdate };
+
 extern std::atomic<bool> IsRunning;
 extern std::atomic<Color> ClearColor;
 
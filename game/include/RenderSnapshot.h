@@ -0,0 +1,36 @@
+#pragma once
+
+#include "raylib.h"
+#include "SpriteManager.h"
+#include "FrameSnapshot.h"
+
+#include <vector>
+
+// immutable copy of everything the render stages need from the simulation
+struct SpriteDrawItem
+{
+    SpriteManager::Sprite* Sprite = nullptr;
+    size_t Frame = 0;
+    float Scale = 1.0f;
+    float Rotation = 0;
+    Color Tint = WHITE;
+
+    Vector2 Position = { 0, 0 };
+    Vector2 Velocity = { 0, 0 };
+    double UpdateTime = 0;
+
+    void Draw(Vector2 position) const
+    {
+        if (Sprite)
+            Sprite->Draw(Frame, position, Scale, Rotation, Tint);
+    }
+};
+
+struct RenderSnapshot
+{
+    std::vector<SpriteDrawItem> Players;
+    std::vector<SpriteDrawItem> Bullets;
+    std::vector<SpriteDrawItem> NPCs;
+};
+
+extern FrameSnapshot<RenderSnapshot> RenderData;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "raylib.h"
+#include "TaskManager.h"
 
 #include <vector>
 #include <string>
@@ -18,6 +19,9 @@ public:
     float ValueScale = 1000.0f;
 
     float MaxClamp = 1.0f / 60.0f;
+
+    // a rescan of Min and Max is queued as main thread maintenance, so the tracker must outlive it
+    bool RescanQueued = false;
 public:
 
     ValueTracker(size_t maxValues, std::string_view name = "Value")
@@ -31,6 +35,7 @@ public:
         if (value > MaxClamp)
             value = MaxClamp;
 
+        float replaced = Values[NextValueIndex];
         Values[NextValueIndex] = value;
         NextValueIndex++;
         if (NextValueIndex >= Values.size())
@@ -38,6 +43,25 @@ public:
             NextValueIndex = 0;
         }
 
+        // only overwriting the value that held Min or Max needs the full scan
+        bool lostExtreme = (replaced >= Max && value < replaced) || (replaced <= Min && value > replaced);
+
+        if (value > Max)
+            Max = value;
+        if (value < Min)
+            Min = value;
+
+        if (lostExtreme && !RescanQueued)
+        {
+            RescanQueued = true;
+            TaskManager::AddMaintenanceJob("ValueTracker Rescan", [this]() { Rescan(); return false; }, true);
+        }
+    }
+
+    void Rescan()
+    {
+        RescanQueued = false;
+
         Max = -100;
         Min = 100;
         for (float v : Values)
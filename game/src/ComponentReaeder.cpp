@@ -1,6 +1,5 @@
 #include "ComponentReader.h"
 
-#include "components/TransformComponent.h"
 #include "components/PlayerComponent.h"
 #include "components/NPCComponent.h"
 #include "components/BulletComponent.h"
@@ -12,18 +11,8 @@ void ComponentReader::OnComponentData(EntitySystem::EntityComponent* component,
     if (component->OnDataRead(buffer))
         return;
 
-    // find the deserializer and call it
-    if (componentId == TransformComponent::GetComponentId())
-    {
-        auto transform = static_cast<TransformComponent*>(component);
-        transform->Position.x = buffer.Read<float>();
-        transform->Position.y = buffer.Read<float>();
-        transform->Velocity.x = buffer.Read<float>();
-        transform->Velocity.y = buffer.Read<float>();
-
-        TraceLog(LOG_INFO, "Loaded Transform for entity %zu", component->EntityID);
-    }
-    else if (componentId == PlayerComponent::GetComponentId())
+    // find the deserializer and call it, data components such as TransformComponent are read by EntityReader
+    if (componentId == PlayerComponent::GetComponentId())
     {
         auto player = static_cast<PlayerComponent*>(component);
         player->Size = buffer.Read<float>();
@@ -11,8 +11,10 @@
 #include "TextureManager.h"
 #include "ResourceManager.h"
 #include "EntityReader.h"
+#include "FlightRecorder.h"
 
 #include "GameInfo.h"
+#include "RenderSnapshot.h"
 
 #include "components/TransformComponent.h"
 #include "components/PlayerComponent.h"
@@ -27,6 +29,7 @@
 #include "tasks/Draw.h"
 #include "tasks/Overlay.h"
 #include "tasks/GUI.h"
+#include "tasks/Snapshot.h"
 
 #include <atomic>
 
@@ -52,6 +55,8 @@ ValueTracker FameTimeTracker(300, "FrameTime");
 
 std::atomic<BoundingBox2D> WorldBounds;
 
+FrameSnapshot<RenderSnapshot> RenderData;
+
 float GetDeltaTime()
 {
     return FPSDeltaTime.load();
@@ -80,17 +85,36 @@ void RegisterTasks()
 {
     TaskManager::AddTask<InputTask>();
     TaskManager::AddTask<DrawTask>();
-    TaskManager::AddTask<OverlayTask>();
+    TaskManager::AddTask<OverlayTask>()->Importance = TaskImportance::Optional;
     TaskManager::AddTask<GUITask>();
+    TaskManager::AddTask<SnapshotTask>();
+
+    TaskManager::AddFrameSyncCallback([]() { RenderData.Publish(); });
 }
 
 void RegisterComponents()
 {
     EntitySystem::RegisterComponent<TransformComponent>();
-    RegisterComponentWithUpdate<PlayerComponent>(FrameStage::Update, true);
-    RegisterComponentWithUpdate<NPCComponent>(FrameStage::FixedUpdate, true);
-    RegisterComponentWithUpdate<BulletComponent>(FrameStage::PreUpdate, true);
-    RegisterComponentWithUpdate<NPCSpawnComponent>(FrameStage::FixedUpdate, true);
+    auto playerUpdate = RegisterComponentWithUpdate<PlayerComponent>(FrameStage::Update, true);
+    RegisterComponentWithUpdate<NPCComponent, TransformComponent>(FrameStage::FixedUpdate, true, true);
+    auto bulletUpdate = RegisterComponentWithUpdate<BulletComponent, EntitySystem::Optional<TransformComponent>>(FrameStage::PreUpdate, true);
+
+    auto bulletSpin = TaskManager::AddTaskOnState<LambdaTask>(FrameStage::PreUpdate, Hashes::CRC64Str("BulletSpin"), "BulletSpin", []()
+        {
+            EntitySystem::ForEachChunk<BulletComponent>([](std::span<BulletComponent> bullets)
+                {
+                    for (BulletComponent& bullet : bullets)
+                        bullet.UpdateSpin();
+                }, true);
+        });
+    bulletSpin->Importance = TaskImportance::Optional;
+    bulletSpin->After(bulletUpdate);
+
+    // players read the input and spawn bullets, they start as soon as both are done instead of after all of PreUpdate
+    playerUpdate->After(TaskManager::GetTask<InputTask>());
+    playerUpdate->After(bulletSpin);
+    TaskManager::DefineStage(AIStage);
+    RegisterComponentWithUpdate<NPCSpawnComponent>(AIStage.Id, true, true);
     EntitySystem::RegisterComponent<PlayerSpawnComponent>();
 }
 
@@ -110,7 +134,14 @@ ComponentReader SceneReader;
 
 void GameInit()
 {
-    TaskManager::Init();
+    TaskManager::Init(ThreadTopology{ .ReservedCores = 2, .PinThreads = true });
+    TaskManager::SetFixedStepPolicy(FixedStepPolicy{ .MaxStepsPerFrame = 4, .BatchCatchUp = true });
+    FlightRecorder::SetSpikeThreshold(0.1f);
+    // finished loads run their callbacks on the main thread as maintenance, between frames
+    ResourceManager::SetMainThreadDispatcher([](std::function<void()> callback)
+        {
+            TaskManager::AddMaintenanceJob("Resource Callbacks", [callback = std::move(callback)]() { callback(); return false; }, true);
+        });
     ResourceManager::Init();
     EntitySystem::Init();
 
@@ -121,6 +152,10 @@ void GameInit()
     TextureManager::Init();
    
     FPSDeltaTime = 1.0f / float(GetMonitorRefreshRate(0));
+    TaskManager::SetMaintenancePolicy(MaintenancePolicy{ .FrameBudget = 0.001f, .TargetFrameTime = FPSDeltaTime.load() });
+
+    // keep some of the refresh interval for the swap, optional work is shed past this
+    TaskManager::SetFrameBudget(FPSDeltaTime.load() * 0.9f);
 
     RegisterLayers();
 
@@ -135,9 +170,10 @@ void GameInit()
 void GameCleanup()
 {
     EntitySystem::ClearAllEntities();
+    // loads in flight finish first, TaskManager::Shutdown then runs the completions they queued
+    ResourceManager::Shutdown();
     TaskManager::Shutdown();
     PresentationManager::Shutdown();
-    ResourceManager::Shutdown();
     TextureManager::Shutdown();
     CloseWindow();
 }
@@ -170,14 +206,12 @@ int main()
         if (IsWindowResized())
             WorldBounds.store(BoundingBox2D{ Vector2{0,0}, Vector2{float(GetScreenWidth()), float(GetScreenHeight())} });
 
-        ResourceManager::Update();
         TextureManager::Update();
         PresentationManager::Update();
         ClearBackground(ClearColor.load());
 
         FrameStartTime.store(GetTime());
         TaskManager::TickFrame();
-        EntitySystem::FlushMorgue();
         LastFrameTime = GetTime() - FrameStartTime;
         FameTimeTracker.AddValue(float(LastFrameTime));
 
@@ -6,7 +6,7 @@
 #include "raylib.h"
 #include "raymath.h"
 
-void BulletComponent::Update()
+void BulletComponent::Update(TransformComponent* transform)
 {
     Lifetime -= GetDeltaTime();
     if (Lifetime < 0)
@@ -15,12 +15,14 @@ void BulletComponent::Update()
         return;
     }
 
-    auto transform = GetEntityComponent<TransformComponent>();
     if (transform)
     {
         transform->Position += transform->Velocity * GetDeltaTime();
     }
+}
 
+void BulletComponent::UpdateSpin()
+{
     Sprite.Rotation += 1000 * GetDeltaTime() * SpinDir;
     Sprite.Rotation = fmodf(Sprite.Rotation, 360);
 }
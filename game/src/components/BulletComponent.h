@@ -22,7 +22,10 @@ struct BulletComponent : public EntitySystem::EntityComponent
 
     SpriteManager::SpriteInstance Sprite;
 
-    void Update();
+    void Update(TransformComponent* transform);
+
+    // cosmetic, run by its own Optional task so it is the first thing shed when the frame is over budget
+    void UpdateSpin();
 
     void OnAwake() override;
     bool OnDataRead(BufferReader& buffer) override;
@@ -45,16 +45,14 @@ void NPCComponent::OnAwake()
 {
 }
 
-void NPCComponent::Update()
+void NPCComponent::Update(TransformComponent& transform)
 {
-    auto transform = GetEntityComponent<TransformComponent>();
-    if (transform)
-    {
-        float realSize = Sprite.SpriteRef->GetFrameRect(Sprite.CurrentFrame).width * Sprite.Scale;
-        float delta = TaskManager::GetFixedDeltaTime();
-        MoveEntity(*transform, realSize*0.5f, transform->Velocity * delta, WorldBounds.load());
-        LastUpdateTime = GetFrameStartTime();
-    }
+    Sprite.Scale = Size / 2.0f;
+    float realSize = Sprite.SpriteRef->GetFrameRect(Sprite.CurrentFrame).width * Sprite.Scale;
+    // step independent, integrates every batched fixed step at once
+    float delta = TaskManager::GetFixedDeltaTime() * TaskManager::GetFixedStepCount();
+    MoveEntity(transform, realSize*0.5f, transform.Velocity * delta, WorldBounds.load());
+    LastUpdateTime = GetFrameStartTime();
 }
 
 bool NPCComponent::OnDataRead(BufferReader& buffer)
@@ -16,7 +16,7 @@ struct NPCComponent : public EntitySystem::EntityComponent
 
     SpriteManager::SpriteInstance Sprite;
 
-    void Update();
+    void Update(TransformComponent& transform);
     void OnAwake() override;
     bool OnDataRead(BufferReader& buffer) override;
 };
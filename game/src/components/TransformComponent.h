@@ -5,18 +5,19 @@
 
 #include "EntitySystem.h"
 
-struct TransformComponent : public EntitySystem::EntityComponent
+// read by every moving entity each step, stored by value in archetype chunks
+struct TransformComponent
 {
-    DECLARE_SIMPLE_COMPONENT(TransformComponent);
+    DECLARE_DATA_COMPONENT(TransformComponent);
 
-    bool OnDataRead(BufferReader& buffer) override
+    bool OnDataRead(BufferReader& buffer)
     {
         Position.x = buffer.Read<float>();
         Position.y = buffer.Read<float>();
         Velocity.x = buffer.Read<float>();
         Velocity.y = buffer.Read<float>();
 
-        TraceLog(LOG_INFO, "Loaded Transform for entity %zu", EntityID);
+        TraceLog(LOG_INFO, "Loaded Transform");
 
         return true;
     }
@@ -24,4 +25,3 @@ struct TransformComponent : public EntitySystem::EntityComponent
     Vector2 Position = Vector2Zeros;
     Vector2 Velocity = Vector2Zeros;
 };
-
@@ -1,12 +1,7 @@
 #include "tasks/Draw.h"
 
-#include "components/TransformComponent.h"
-#include "components/PlayerComponent.h"
-#include "components/NPCComponent.h"
-#include "components/BulletComponent.h"
-
 #include "PresentationManager.h"
-#include "EntitySystem.h"
+#include "RenderSnapshot.h"
 #include "GameInfo.h"
 
 void DrawTask::Tick()
@@ -15,40 +10,25 @@ void DrawTask::Tick()
     DrawRectangleGradientEx(PresentationManager::GetCurrentLayerRect(), BLACK, BLACK, Color(0, 0, 40, 255), Color(40,40,40,255));
     PresentationManager::EndLayer();
 
+    const RenderSnapshot& snapshot = RenderData.GetPublished();
+
     PresentationManager::BeginLayer(PlayerLayer);
-    EntitySystem::DoForEachComponent<PlayerComponent>([&](auto& player)
-        {
-            auto transform = player.GetEntityComponent<TransformComponent>();
-            if (transform)
-            {
-                player.Sprite.Draw(transform->Position, WHITE);
-            }
-        });
+    for (const auto& player : snapshot.Players)
+        player.Draw(player.Position);
 
-    EntitySystem::DoForEachComponent<BulletComponent>([&](auto& bullet)
-        {
-            auto transform = bullet.GetEntityComponent<TransformComponent>();
-            if (transform)
-            {
-                bullet.Sprite.Draw(transform->Position, bullet.Tint);
-            }
-        });
+    for (const auto& bullet : snapshot.Bullets)
+        bullet.Draw(bullet.Position);
     PresentationManager::EndLayer();
 
     PresentationManager::BeginLayer(NPCLayer);
     double now = GetTime();
-    EntitySystem::DoForEachComponent<NPCComponent>([&](NPCComponent& npc)
-        {
-            auto transform = npc.GetEntityComponent<TransformComponent>();
-            if (transform)
-            {
-                Vector2 interpPos = transform->Position - Vector2(npc.Size, npc.Size);
-                if (UseInterpolateNPCs)
-                    interpPos += transform->Velocity * float(now - npc.LastUpdateTime);
+    for (const auto& npc : snapshot.NPCs)
+    {
+        Vector2 interpPos = npc.Position;
+        if (UseInterpolateNPCs)
+            interpPos += npc.Velocity * float(now - npc.UpdateTime);
 
-                npc.Sprite.Scale = npc.Size / 2.0f;
-                npc.Sprite.Draw(interpPos, npc.Tint);
-            }
-        });
+        npc.Draw(interpPos);
+    }
     PresentationManager::EndLayer();
 }
@@ -1,6 +1,9 @@
 #include "tasks/Input.h"
 
 #include "EntitySystem.h"
+#include "TaskManager.h"
+#include "Trace.h"
+#include "FlightRecorder.h"
 #include "GameInfo.h"
 
 #include "components/PlayerComponent.h"
@@ -25,6 +28,22 @@ void InputTask::Tick()
     if (IsKeyPressed(KEY_F2))
         UseInterpolateNPCs = !UseInterpolateNPCs;
 
+    if (IsKeyPressed(KEY_F3))
+        Trace::Capture(120, "trace.json");
+
+    if (IsKeyPressed(KEY_F5))
+        FlightRecorder::Dump("requested");
+
+    if (IsKeyPressed(KEY_F4))
+        TaskManager::SetPipelinedFrames(!TaskManager::IsPipelinedFrames());
+
+    if (IsKeyPressed(KEY_F6))
+    {
+        WorkerIdlePolicy policy = TaskManager::GetIdlePolicy();
+        policy.Mode = WorkerIdleMode((uint8_t(policy.Mode) + 1) % 3);
+        TaskManager::SetIdlePolicy(policy);
+    }
+
     if (IsKeyPressed(KEY_ENTER))
         EntitySystem::AwakeAllEntities();
 
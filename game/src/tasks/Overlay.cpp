@@ -21,27 +21,61 @@ void OverlayTask::Tick()
     else
         DrawText("Interpolation: OFF (Press F2 to toggle)", x, y, 20, RED);
 
+    if (TaskManager::IsPipelinedFrames())
+        DrawText("Pipelined: ON (Press F4 to toggle)", x, y + 20, 20, GREEN);
+    else
+        DrawText("Pipelined: OFF (Press F4 to toggle)", x, y + 20, 20, RED);
+
+    static constexpr const char* IdleModeNames[] = { "Spin", "Power Save", "Adaptive" };
+    WorkerIdleStats idle = TaskManager::GetIdleStats();
+    DrawText(TextFormat("Workers idle: %s (F6) spin %llu yield %llu park %llu",
+        IdleModeNames[size_t(TaskManager::GetIdlePolicy().Mode)],
+        (unsigned long long)idle.SpinHits,
+        (unsigned long long)idle.YieldHits,
+        (unsigned long long)idle.Parks), x, y + 40, 10, WHITE);
+
     Rectangle graphBounds = { float(x + 460), float(y + 3), 400, 60 };
     FameTimeTracker.DrawGraph(graphBounds);
 
 #if defined(DEBUG)
     y = 30;
-    for (FrameStage stage = FrameStage::FrameHead; stage <= FrameStage::FrameTail; ++stage)
+    for (FrameStage stage : TaskManager::GetStageOrder())
     {
         auto& stats = TaskManager::GetStatsForStage(stage);
         if (stats.TaskCount == 0)
             continue;
 
-        const char* text = TextFormat("%s %d Tasks in %0.3f ms [Max %0.3f] (Blocked for %0.3f ms [Max %0.3f])",
+        const char* text = TextFormat("%s %d Tasks in %0.3f ms [Max %0.3f] (Blocked for %0.3f ms [Max %0.3f], Wake %0.3f us [Max %0.3f]) Makespan %0.3f ms [Predicted %0.3f] Helped %d in %0.3f ms Shed %d/%d [Total %llu/%llu]",
             GetStageName(stage),
             stats.TaskCount,
             stats.Durration * 1000.0,
             stats.MaxDurration * 1000.0,
             stats.BlockedDurration * 1000.0,
-            stats.MaxBlockedDurration * 1000.0);
+            stats.MaxBlockedDurration * 1000.0,
+            stats.WakeLatency * 1000000.0,
+            stats.MaxWakeLatency * 1000000.0,
+            stats.Makespan * 1000.0,
+            stats.PredictedMakespan * 1000.0,
+            stats.HelpedTasks,
+            stats.HelpedDurration * 1000.0,
+            stats.SkippedTasks,
+            stats.DeferredTasks,
+            (unsigned long long)stats.TotalSkippedTasks,
+            (unsigned long long)stats.TotalDeferredTasks);
 
         DrawText(text, 20, y, 10, GRAY);
 
+        if (TaskManager::IsFixedStage(stage))
+        {
+            const char* stepText = TextFormat("%0.0f Hz %d Steps [Max %d] Dropped %0.3f ms [Total %0.3f]",
+                TaskManager::GetFixedRate(stage),
+                stats.FixedSteps,
+                stats.MaxFixedSteps,
+                stats.DroppedTime * 1000.0,
+                stats.TotalDroppedTime * 1000.0);
+            DrawText(stepText, 30 + MeasureText(text, 10), y, 10, GRAY);
+        }
+
         DrawRectangle(5, y, 8, 8, stats.TickedThisFrame ? GREEN : RED);
 
         y += 10;
@@ -0,0 +1,49 @@
+#include "tasks/Snapshot.h"
+
+#include "components/TransformComponent.h"
+#include "components/PlayerComponent.h"
+#include "components/NPCComponent.h"
+#include "components/BulletComponent.h"
+
+#include "EntityQuery.h"
+#include "RenderSnapshot.h"
+
+static SpriteDrawItem MakeDrawItem(const SpriteManager::SpriteInstance& sprite, const TransformComponent& transform, Color tint)
+{
+    SpriteDrawItem item;
+    item.Sprite = sprite.SpriteRef.get();
+    item.Frame = sprite.CurrentFrame;
+    item.Scale = sprite.Scale;
+    item.Rotation = sprite.Rotation;
+    item.Tint = tint;
+    item.Position = transform.Position;
+    item.Velocity = transform.Velocity;
+    return item;
+}
+
+void SnapshotTask::Tick()
+{
+    RenderSnapshot& snapshot = RenderData.GetWriteBuffer();
+    snapshot.Players.clear();
+    snapshot.Bullets.clear();
+    snapshot.NPCs.clear();
+
+    EntitySystem::Query<PlayerComponent, TransformComponent>().Each([&](PlayerComponent& player, TransformComponent& transform)
+        {
+            snapshot.Players.push_back(MakeDrawItem(player.Sprite, transform, WHITE));
+        });
+
+    EntitySystem::Query<BulletComponent, TransformComponent>().Each([&](BulletComponent& bullet, TransformComponent& transform)
+        {
+            snapshot.Bullets.push_back(MakeDrawItem(bullet.Sprite, transform, bullet.Tint));
+        });
+
+    EntitySystem::Query<NPCComponent, TransformComponent>().Each([&](NPCComponent& npc, TransformComponent& transform)
+        {
+            SpriteDrawItem item = MakeDrawItem(npc.Sprite, transform, npc.Tint);
+            item.Position = transform.Position - Vector2(npc.Size, npc.Size);
+            item.Scale = npc.Size / 2.0f;
+            item.UpdateTime = npc.LastUpdateTime;
+            snapshot.NPCs.push_back(item);
+        });
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Task.h"
+
+// copies render data out of the components once the simulation is done with them
+class SnapshotTask : public Task
+{
+public:
+    DECLARE_TASK(SnapshotTask);
+    SnapshotTask() : Task(FrameStage::PostUpdate, false) {}
+
+protected:
+    void Tick() override;
+};
@@ -41,6 +41,19 @@ newoption
     },
     default = "off"
 }
+
+newoption
+{
+    trigger = "tracing",
+    value = "TRACING",
+    description = "compile in engine trace zones (Chrome trace capture)",
+    allowed = {
+        { "off", "Off"},
+        { "on", "On"}
+    },
+    default = "off"
+}
+
 function string.starts(String,Start)
     return string.sub(String,1,string.len(Start))==Start
 end
@@ -156,6 +169,9 @@ workspace (workspaceName)
     filter { "platforms:Arm64" }
         architecture "ARM64"
 
+    filter {"options:tracing=on"}
+        defines { "ENGINE_TRACING" }
+
     filter {}
 
     targetdir "bin/%{cfg.buildcfg}/"